@@ -35,6 +35,41 @@
 //
 #define I2C_ADDRESS 0b1100000
 
+// glide settings
+#define GLIDE_RATE			0x01	// glide_mode bit for constant rate
+#define GLIDE_LEGATO		0x02	// glide_mode bit for glide only between held notes
+#define GLIDE_MS_UNIT		16		// ms of glide time per unit of glide setting
+#define GLIDE_UPDATE_MS		4		// ms between DAC updates while gliding
+
+// MIDI clock tempo settings
+#define BPM_UPDATE_MS		20		// ms between DAC updates for tempo outputs
+#define BPM_TIMEOUT_MS		120		// ms without a tick after which the clock is stopped
+#define BPM_STOPPED			0xFF	// l_bpm_gap value when the clock is stopped
+
+// smoothing settings for outputs in MIDI CC, aftertouch, bend and NRPN modes
+#define SLEW_MAX			12		// max slew setting (time constant 2^12 ms)
+
+// LFO settings. Phase is 24 bits with one cycle = 0x1000000
+#define LFO_PHASE_MASK		0xFFFFFFL
+#define LFO_PHASE_HALF		0x800000L
+#define DEFAULT_LFO_RATE	40
+
+// envelope settings. Level is 24 bits with full level = 0x800000.
+// The attack aims past full level so that it reaches it
+#define ENV_PEAK			0x800000L
+#define ENV_ATTACK_TARGET	0xA00000L
+#define DEFAULT_ENV_ATTACK	20
+#define DEFAULT_ENV_DECAY	50
+#define DEFAULT_ENV_SUSTAIN	100
+#define DEFAULT_ENV_RELEASE	60
+
+// modulation settings
+#define CV_MOD_MAX			2		// number of modulation slots per output
+#define MOD_DEPTH_NONE		64
+
+// 14-bit controller settings
+#define CC_LSB_WAIT_MS		2		// ms to hold the DAC for an LSB after an MSB
+
 //
 // TYPE DEFS
 //
@@ -50,7 +85,20 @@ enum {
 	CV_MIDI_BPM, // mapped to midi CC
 	CV_TEST,			// mapped to test voltage	
 	CV_NOTE_HZV, // mapped to Hz/Volt note
-	CV_NOTE_12VO // mapped to 1.2V/oct
+	CV_NOTE_12VO, // mapped to 1.2V/oct
+	CV_MIDI_NRPN,	// mapped to 14-bit NRPN value
+	CV_LFO,			// mapped to LFO
+	CV_ENV,			// mapped to envelope from note stack
+	CV_ENV_VEL,		// mapped to velocity scaled envelope
+	CV_POLY_TOUCH	// mapped to poly aftertouch of a note output
+};
+
+// envelope stages
+enum {
+	ENV_IDLE = 0,
+	ENV_ATTACK,
+	ENV_DECAY,		// decay, then holding at sustain level
+	ENV_RELEASE
 };
 
 typedef struct {
@@ -61,6 +109,8 @@ typedef struct {
 	byte stack_id;
 	byte out;
 	byte transpose;  
+	byte glide;			// glide time (0 = no glide)
+	byte glide_mode;	// GLIDE_xxx bits
 } T_CV_EVENT;
 
 typedef struct {
@@ -69,20 +119,65 @@ typedef struct {
 	byte ofs;
 	byte scale;
 	byte chan;
-	byte cc;
+	byte cc;		// CC number, or NRPN param low byte
+	byte nrpn_hi;	// NRPN param high byte
+	byte slew;		// smoothing time constant shift (0 = off)
+	byte curve;		// NRPVL_CURVE_xxx response curve (also used by
+					// velocity and poly aftertouch in place of glide_mode)
 } T_CV_MIDI;
 
+typedef struct {
+	byte mode;	// CV_xxx enum
+	byte volts;	
+	byte ofs;
+	byte scale;
+	byte wave;			// NRPVL_LFO_xxx waveform
+	byte rate;			// free running rate (0-127)
+	unsigned int div;	// MIDI clock ticks per cycle (0 = free running)
+} T_CV_LFO;
+
+typedef struct {
+	byte mode;	// CV_xxx enum
+	byte volts;	
+	byte ofs;
+	byte scale;
+	byte stack_id;		// must align with T_CV_EVENT
+	byte attack;		// segment times (0-127)
+	byte decay;
+	byte sustain;		// sustain level (0-127)
+	byte release;
+} T_CV_ENV;
+
+// modulation slot. The source and its parameter share one byte,
+// which is 0x80 + the CC number for a CC, otherwise the 
+// NRPVH_MOD_xxx source * 4 + the note stack or LFO output 
+#define MOD_KEY(src, param)	(((src) == NRPVH_MOD_CC)? (0x80|(param)) : ((src)<<2|(param)))
+#define MOD_SRC(key)		(((key) & 0x80)? NRPVH_MOD_CC : (key)>>2)
+typedef struct {
+	byte key;		// MOD_KEY of source and parameter
+	byte depth;		// 64 = none, 0 = most negative, 127 = most positive
+} T_CV_MOD;
+
 typedef union {
 	T_CV_EVENT 				event;
 	T_CV_MIDI 				midi;
+	T_CV_LFO 				lfo;
+	T_CV_ENV 				env;
 } CV_OUT;
 
 //
 // LOCAL DATA
 //
 
-// cache of raw DAC data
-int l_dac[CV_MAX] = {0};
+// DAC data is double buffered: outputs are written to the 
+// back buffer at any time, and the values that differ from 
+// the front buffer (last sent to the DAC) are committed when 
+// the main loop schedules a DAC transfer
+int l_dac[CV_MAX] = {0};		// back buffer
+int l_dac_front[CV_MAX];		// front buffer (-1 to force a send)
+
+// DAC channel (A=0..D=3) for each output
+byte l_dac_chan[CV_MAX] = {3, 0, 2, 1};
 
 // CV config 
 CV_OUT l_cv[CV_MAX];
@@ -90,6 +185,129 @@ CV_OUT l_cv[CV_MAX];
 // cache of the notes playing on each output
 int l_note[CV_MAX];
 
+// note tables: calibrated DAC value for each octave for
+// outputs in note modes. The top octave (8V for 1V/octave,
+// which is as high as the DAC goes) continues with the span 
+// of the octave below it, and higher notes are held at the 
+// top of that octave
+#define NOTE_OCTAVES 	9
+#define NOTE_TABLE_MAX	((long)NOTE_OCTAVES*12*256 - 1)
+int l_note_table[CV_MAX][NOTE_OCTAVES];
+byte l_note_table_stale;	// bit mask of outputs with note table to rebuild
+
+// per-octave calibration: DAC count correction added to each 
+// note table entry after scale and offset (64 = no correction)
+byte l_cal_point[CV_MAX][NOTE_OCTAVES];
+
+// glide state for outputs in note modes. Pitch is in 1/65536
+// semitone units and the step is added every GLIDE_UPDATE_MS
+long l_glide_pos[CV_MAX];		// current pitch
+long l_glide_target[CV_MAX];	// pitch we are gliding to 
+long l_glide_step[CV_MAX];		// step per update
+byte l_gliding;					// bit mask of outputs gliding
+byte l_glide_from;				// bit mask of outputs where glide pos is a pitch already played
+byte l_glide_tick;				// ms until next glide update
+byte l_note_held;				// bit mask of outputs where stack has notes held
+
+// outputs in MIDI CC, aftertouch, bend and NRPN modes do not
+// glide, so use the same pos/target for smoothing. Values are
+// uncalibrated DAC counts in 1/65536 count units
+byte l_slewing;					// bit mask of outputs moving to a new value
+
+// LFO outputs do not glide either, so use the glide pos for the
+// phase and target for the phase step per ms when synced to 
+// MIDI clock. The note cache holds the clock tick count and the
+// glide step holds the phase step per tick
+byte l_lfo_high;				// bit mask of LFOs in second half of cycle
+unsigned int l_lfo_random;		// shift register for sample and hold
+
+// envelope outputs use the glide pos for the level, and the 
+// note cache for the velocity of the note that started them
+byte l_env_stage[CV_MAX];		// ENV_xxx stage
+
+// MIDI clock tempo measurement. Tick times are timer 1 counts (2us)
+unsigned int l_bpm_last_tick;	// time of last clock tick
+long l_bpm_period;				// filtered tick period x 16 (0 if not known yet)
+byte l_bpm_gap;					// ms since last clock tick
+byte l_bpm_timer;				// ms until next tempo output update
+
+// 14-bit controllers. A CC 0-31 output becomes 14-bit once
+// it has seen the LSB on CC 32-63 (and an NRPN output once 
+// it has seen data entry LSB). Until then an MSB alone gives
+// the same result as a 7-bit CC
+byte l_cc_msb[CV_MAX];			// last MSB for each output
+byte l_cc_14bit;				// bit mask of outputs that have seen an LSB
+
+// modulation matrix. Each output can add up to CV_MOD_MAX scaled 
+// sources to the value from its own source. Source values are 
+// 14-bit, and centred on zero for bend and LFO sources
+T_CV_MOD l_cv_mod[CV_MAX][CV_MOD_MAX];	// config
+int l_mod_value[CV_MAX][CV_MOD_MAX];	// latest value of each source
+int l_mod_base[CV_MAX];					// DAC value before modulation
+byte l_mod_active;						// bit mask of outputs with modulation
+byte l_mod_filter;						// MIDI_FILTER_xxx bits for global channel
+
+// routing table: bit mask of outputs in MIDI CC, aftertouch or 
+// pitch bend modes that listen to each MIDI channel
+byte l_cv_route[16];
+
+// response curves for 7-bit values, held in program memory. 
+// Full scale is 255 rather than 127, where x = value/127
+
+// exponential: 255 * (2^(5x) - 1) / 31
+rom char *l_curve_exp = {
+	0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4,
+	5, 5, 5, 6, 6, 6, 7, 7, 8, 8, 8, 9, 9, 10, 10, 11,
+	11, 12, 13, 13, 14, 14, 15, 16, 16, 17, 18, 18, 19, 20, 21, 21,
+	22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 38,
+	39, 40, 42, 43, 44, 46, 47, 49, 50, 52, 54, 55, 57, 59, 61, 63,
+	65, 67, 69, 71, 73, 75, 78, 80, 83, 85, 88, 90, 93, 96, 99, 102,
+	105, 108, 111, 114, 118, 121, 125, 129, 132, 136, 140, 144, 149, 153, 157, 162,
+	167, 171, 176, 181, 187, 192, 198, 203, 209, 215, 221, 228, 234, 241, 248, 255
+};
+
+// logarithmic: 255 * log2(1 + 31x) / 5
+rom char *l_curve_log = {
+	0, 16, 29, 40, 50, 59, 66, 73, 80, 86, 91, 96, 101, 105, 109, 113,
+	117, 121, 124, 127, 130, 133, 136, 139, 142, 144, 147, 149, 151, 154, 156, 158,
+	160, 162, 164, 166, 168, 170, 171, 173, 175, 176, 178, 180, 181, 183, 184, 186,
+	187, 188, 190, 191, 193, 194, 195, 196, 198, 199, 200, 201, 202, 203, 205, 206,
+	207, 208, 209, 210, 211, 212, 213, 214, 215, 216, 217, 218, 219, 220, 221, 221,
+	222, 223, 224, 225, 226, 227, 227, 228, 229, 230, 231, 231, 232, 233, 234, 234,
+	235, 236, 237, 237, 238, 239, 239, 240, 241, 241, 242, 243, 243, 244, 245, 245,
+	246, 247, 247, 248, 249, 249, 250, 250, 251, 252, 252, 253, 253, 254, 254, 255
+};
+
+// S-curve: 255 * (3x^2 - 2x^3)
+rom char *l_curve_s = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 4, 4, 5, 6, 7, 9, 10,
+	11, 12, 14, 15, 17, 19, 20, 22, 24, 26, 28, 30, 32, 34, 36, 38,
+	40, 43, 45, 47, 50, 52, 55, 57, 60, 63, 65, 68, 71, 73, 76, 79,
+	82, 85, 87, 90, 93, 96, 99, 102, 105, 108, 111, 114, 117, 120, 123, 126,
+	129, 132, 135, 138, 141, 144, 147, 150, 153, 156, 159, 162, 165, 168, 170, 173,
+	176, 179, 182, 184, 187, 190, 192, 195, 198, 200, 203, 205, 208, 210, 212, 215,
+	217, 219, 221, 223, 225, 227, 229, 231, 233, 235, 236, 238, 240, 241, 243, 244,
+	245, 246, 248, 249, 250, 251, 251, 252, 253, 253, 254, 254, 255, 255, 255, 255
+};
+
+// Hz/V position of each quarter semitone (0 to 48) within an
+// octave, as the fraction of the octave span in 1/32768 units:
+// 32768 * (2^(quarter/48)-1). Program memory tables hold bytes, 
+// so the high and low bytes are kept apart
+#define HZV_POS(quarter) ((unsigned int)l_hzv_pos_hi[quarter]<<8|l_hzv_pos_lo[quarter])
+rom char *l_hzv_pos_hi = {
+	0, 1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 22, 24, 26, 28, 30,
+	33, 35, 37, 40, 42, 45, 47, 50, 53, 55, 58, 61, 63, 66, 69, 72,
+	75, 78, 81, 84, 87, 90, 93, 96, 100, 103, 106, 110, 113, 117, 120, 124,
+	128
+};
+rom char *l_hzv_pos_lo = {
+	0, 221, 192, 171, 156, 149, 150, 158, 173, 196, 227, 9, 56, 111, 174, 245,
+	69, 158, 255, 105, 220, 88, 222, 109, 5, 167, 83, 9, 201, 147, 103, 70,
+	48, 37, 36, 47, 69, 103, 148, 205, 18, 99, 193, 43, 162, 37, 182, 84,
+	0
+};
+
 //
 // LOCAL FUNCTIONS
 //
@@ -107,15 +325,41 @@ static void cv_config_dac() {
 }
 
 ////////////////////////////////////////////////////////////
-// STORE AN OUTPUT VALUE READY TO SEND TO DAC
-static void cv_update(byte which, int value) {
-	
+// APPLY CALIBRATION TO A DAC VALUE
+static int cv_cal(byte which, int value) {
 	if(l_cv[which].event.scale) {
 		long scale = (long)l_cv[which].event.scale - 64;
 		long ofs = (long)l_cv[which].event.ofs - 64;
-		value = (((long)value * (4096 + scale))/4096) + ofs;
+		// value and scale factor are never negative so the 
+		// shift gives the same result as dividing by 4096
+		value = (((long)value * (4096 + scale))>>12) + ofs;
+	}
+	return value;
+}
+
+////////////////////////////////////////////////////////////
+// GET THE TOTAL MODULATION FOR A CV OUTPUT IN DAC COUNTS
+// Full scale of a source at full depth is about 2V
+static int cv_mod_offset(byte which) {
+	long ofs = 0;
+	for(byte slot=0; slot<CV_MOD_MAX; ++slot) {
+		T_CV_MOD *pmod = &l_cv_mod[which][slot];
+		if(MOD_SRC(pmod->key) != NRPVH_MOD_NONE) {
+			ofs += (long)l_mod_value[which][slot] * ((int)pmod->depth - MOD_DEPTH_NONE);
+		}
+	}
+	return ofs >> 10;
+}
+
+////////////////////////////////////////////////////////////
+// STORE A CALIBRATED VALUE READY TO SEND TO DAC
+static void cv_set_dac(byte which, int value) {
+	// modulation is added on top, keeping the value from the 
+	// output's own source so a modulation source can change alone
+	if(l_mod_active & (1<<which)) {
+		l_mod_base[which] = value;
+		value += cv_mod_offset(which);
 	}
-	
 	if(value < 0) 
 		value = 0;
 	if(value > 4095) 
@@ -129,76 +373,198 @@ static void cv_update(byte which, int value) {
 }	
 
 ////////////////////////////////////////////////////////////
-// WRITE A NOTE VALUE TO A CV OUTPUT
-// pitch_bend units = MIDI note * 256
-static void cv_write_note(byte which, long note, int pitch_bend, long dacs_per_oct) {
-	note <<= 8;
-	note += pitch_bend;
-	note *= dacs_per_oct;
-	note /= 12;	
-	note >>= 8;
-	cv_update(which, note);
-}
-
-
-////////////////////////////////////////////////////////////
-// WRITE A NOTE VALUE TO A CV OUTPUT
-// pitch_bend units = MIDI note * 256
-static void cv_write_note_hzvolt(byte which, long note, int pitch_bend) {
-
-	// convert pitch bend to whole notes and fractional (1/256) notes
-	note <<= 8;
-	note += pitch_bend;
-	pitch_bend = note & 0xFF;
-	note >>= 8;
-
-	// use a hard coded lookup table to get the
-	// the DAC value for note in top octave
-	int dac;
-	if(note == 72)
-		dac = 4000;	// we can just about manage a C6!
-	else switch((byte)note % 12) {	
-		case 0: dac = 2000; break;
-		case 1: dac = 2119; break;
-		case 2: dac = 2245; break;
-		case 3: dac = 2378; break;
-		case 4: dac = 2520; break;
-		case 5: dac = 2670; break;
-		case 6: dac = 2828; break;
-		case 7: dac = 2997; break;
-		case 8: dac = 3175; break;
-		case 9: dac = 3364; break;
-		case 10: dac = 3564; break;
-		case 11: dac = 3775; break;	
-	}
-
-	/*
-		next dac note will be dac*(2^(1/12))
-		approximately equal to dac * (1 + 244/(16*256))
-		pitch_bend contains 256 * fractional note (signed)
-		so dac offset for fractional bend = 
-			dac * (pitch_bend/256)*(244/(16*256))
-		
-			= (dac * 244 * pitch_bend) / (16*256*256)
-			= (dac * 244 * pitch_bend) / 1048576 		(0x100000L)
-			
-		
-		NB: this results in linear interpolation between the notes, 
-		which is a bad approximation of a smooth bend since the 
-		mapping of V to Hz is logarithmic not linear!
-		
-		It'll have to do for now...
-	*/
-	dac += (int)(((long)dac*244*pitch_bend)/0x100000L);
+// UPDATE A MODULATION SOURCE
+// Only outputs using the source are recomputed
+static void cv_mod_input(byte src, byte param, int value) {
+	byte key = MOD_KEY(src, param);
+	byte mask = l_mod_active;
+	for(byte which=0; mask; ++which, mask>>=1) {
+		if(!(mask & 1)) {
+			continue;
+		}
+		byte changed = 0;
+		for(byte slot=0; slot<CV_MOD_MAX; ++slot) {
+			T_CV_MOD *pmod = &l_cv_mod[which][slot];
+			if(pmod->key == key && l_mod_value[which][slot] != value) {
+				l_mod_value[which][slot] = value;
+				changed = 1;
+			}
+		}
+		if(changed) {
+			cv_set_dac(which, l_mod_base[which]);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// STORE AN OUTPUT VALUE READY TO SEND TO DAC
+static void cv_update(byte which, int value) {
+	cv_set_dac(which, cv_cal(which, value));
+}	
+
+////////////////////////////////////////////////////////////
+// BUILD THE NOTE TABLE FOR A CV OUTPUT
+// Stores the calibrated DAC value for C of each octave 
+// using the output's pitch scheme. Scale and offset are 
+// applied first, then the per-octave correction. Calibration
+// is linear between octave points, so notes in between can 
+// be interpolated from the calibrated values
+static void cv_note_table(byte which) {
+	int *table = l_note_table[which];
+	int value;
+	for(byte octave=0; octave<NOTE_OCTAVES; ++octave) {
+		switch(l_cv[which].event.mode) {
+		case CV_NOTE_HZV:
+			if(octave <= 5)
+				value = 2000>>(5-octave);
+			else
+				value = 4000;	// we can just about manage a C6!
+			break;
+		case CV_NOTE_12VO:
+			value = (int)octave * 600;
+			break;
+		default:
+			value = (int)octave * 500;
+			break;
+		}
+		table[octave] = cv_cal(which, value) + (int)l_cal_point[which][octave] - 64;
+	}
+	l_note_table_stale &= ~(1<<which);
+}
+
+////////////////////////////////////////////////////////////
+// WRITE A PITCH TO A CV OUTPUT
+// pitch units = MIDI note * 256
+static void cv_write_pitch(byte which, long pitch) {
+	if(pitch < 0) 
+		pitch = 0;
+	if(pitch > NOTE_TABLE_MAX) 
+		pitch = NOTE_TABLE_MAX;
+	byte frac = (byte)pitch;
+	byte semitone = (byte)(pitch>>8);
+	byte octave = 0;
+	while(semitone >= 12) {
+		semitone -= 12;
+		++octave;
+	}
 	
-	// transpose to the requested octave by 
-	// right shifting
-	byte octave = ((byte)note)/12;
-	if(octave > 5) octave = 5;
-	dac >>= (5-octave);
-		
-	// finally update dac
-	cv_update(which, dac);
+	// get the DAC values for the octave either side
+	int *table = l_note_table[which];
+	int dac = table[octave];
+	int span;
+	if(octave < NOTE_OCTAVES-1) {
+		span = table[octave+1] - dac;
+	}
+	else {
+		span = dac - table[octave-1];
+	}
+
+	// get the position within the octave in 1/32768 octave 
+	// units. For Hz/V this follows the exponential curve, 
+	// interpolating linearly between quarter semitones, which 
+	// keeps the error well below one DAC step
+	unsigned int pos;
+	if(l_cv[which].event.mode == CV_NOTE_HZV) {
+		byte quarter = (semitone<<2)|(frac>>6);
+		pos = HZV_POS(quarter);
+		unsigned int step = HZV_POS(quarter+1) - pos;
+		pos += (step * (frac & 0x3F) + 32)>>6;
+	}
+	else {
+		// 1/256 semitones * 32768/3072
+		pos = (((long)semitone<<8|frac) * 10923)>>10;
+	}
+
+	dac += (int)(((long)span * pos + 16384)>>15);
+	cv_set_dac(which, dac);
+}
+
+////////////////////////////////////////////////////////////
+// MOVE A CV OUTPUT TO A NEW NOTE OR BEND 
+// pitch units = MIDI note * 256. new_note is set when the
+// note has changed, which is when a glide can start. Any 
+// division happens here, never in the per-tick update
+static void cv_glide_to(byte which, long pitch, byte new_note) {
+	if(l_note_table_stale & (1<<which)) {
+		cv_note_table(which);
+	}
+	T_CV_EVENT *pcv = &l_cv[which].event;
+	long target = pitch<<8;
+	l_glide_target[which] = target;
+	if(new_note) {
+		l_gliding &= ~(1<<which);
+		if(!(l_glide_from & (1<<which))) {
+			// nothing played since a reset or change of source, 
+			// so there is no pitch to glide from
+			l_glide_pos[which] = target;
+			l_glide_from |= (1<<which);
+		}
+		if(pcv->glide && (!(pcv->glide_mode & GLIDE_LEGATO) || (l_note_held & (1<<which)))) {
+			long step;
+			long delta = target - l_glide_pos[which];
+			int recip = 4096/pcv->glide;
+			if(pcv->glide_mode & GLIDE_RATE) {
+				// fixed time per octave
+				step = 12L * recip;
+				if(delta < 0) {
+					step = -step;
+				}
+			}
+			else {
+				// fixed time for any interval
+				step = ((delta>>8) * recip)>>8;
+			}
+			if(step) {
+				l_glide_step[which] = step * GLIDE_UPDATE_MS;
+				l_gliding |= (1<<which);
+			}
+		}
+		l_note_held |= (1<<which);
+	}
+	
+	// unless we are gliding, jump straight to the new pitch
+	if(!(l_gliding & (1<<which))) {
+		l_glide_pos[which] = target;
+		cv_write_pitch(which, pitch);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// WRITE A MIDI CONTROLLER VALUE TO A CV OUTPUT
+// If smoothing is enabled the value becomes the target that
+// cv_run() moves the output towards, otherwise it is written
+// straight away
+static void cv_write_smooth(byte which, int value) {
+	CV_OUT *pcv = &l_cv[which];
+	switch(pcv->midi.mode) {
+	case CV_MIDI_CC:
+	case CV_MIDI_NRPN:
+	case CV_MIDI_TOUCH:
+	case CV_MIDI_BEND:
+		if(pcv->midi.slew) {
+			l_glide_target[which] = (long)value<<16;
+			l_slewing |= (1<<which);
+			return;
+		}
+		// keep the position in step, so that smoothing turned
+		// on later starts from the value on the output
+		l_glide_pos[which] = (long)value<<16;
+		break;
+	}
+	cv_update(which, value);
+}
+
+////////////////////////////////////////////////////////////
+// LOOK UP A 7-BIT VALUE IN A RESPONSE CURVE
+static byte cv_curve(byte curve, byte value) {
+	switch(curve) {
+	case NRPVL_CURVE_EXP:
+		return l_curve_exp[value];
+	case NRPVL_CURVE_LOG:
+		return l_curve_log[value];
+	default:
+		return l_curve_s[value];
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -206,12 +572,18 @@ static void cv_write_note_hzvolt(byte which, long note, int pitch_bend) {
 static void cv_write_7bit(byte which, byte value, byte volts) {
 	if(value > 127) 
 		value = 127;
+	// curves have full scale 255, which is ~ 2 * value * volts
+	byte curve = l_cv[which].midi.curve;
+	if(curve != NRPVL_CURVE_LINEAR) {
+		cv_write_smooth(which, ((int)cv_curve(curve, value) * volts)<<1);
+		return;
+	}
 	// 1 volt is 500 clicks on the DAC
 	// So (500 * volts) is the full range for the 7-bit value (127)
 	// DAC value = (value / 127) * (500 * volts)
 	// = 3.937 * value * volts
 	// ~ 4 * value * volts
-	cv_update(which, ((int)value * volts)<<2);
+	cv_write_smooth(which, ((int)value * volts)<<2);
 }
 
 ////////////////////////////////////////////////////////////
@@ -223,7 +595,7 @@ static void cv_write_bend(byte which, int value, byte volts) {
 	// DAC value = (value / 16384) * (500 * volts)
 	// = (value / 32.768) * volts
 	// ~ (volts * value)/32
-	cv_update(which, (((long)value * volts) >> 5));
+	cv_write_smooth(which, (((long)value * volts) >> 5));
 }
 
 ////////////////////////////////////////////////////////////
@@ -238,18 +610,52 @@ static void cv_write_volts(byte which, byte value) {
 
 ////////////////////////////////////////////////////////////
 // COPY CURRENT OUTPUT VALUES TO TRANSMIT BUFFER FOR DAC
-void cv_dac_prepare() {	
+// Only outputs that differ from the front buffer are sent.
+// When only one or two outputs have changed they are sent 
+// with the multi-write command (3 bytes each), otherwise all 
+// four are sent with the fast write command (8 bytes).
+// Returns zero if nothing differs from the front buffer, in
+// which case there is nothing to send
+byte cv_dac_prepare() {	
+	byte dirty = 0;
+	byte count = 0;
+	byte which;
+	for(which=0; which<CV_MAX; ++which) {
+		if(l_dac[which] != l_dac_front[which]) {
+			l_dac_front[which] = l_dac[which];
+			dirty |= (1<<which);
+			++count;
+		}
+	}
+	if(!count) {
+		return 0;
+	}
 	g_i2c_tx_buf[0] = I2C_ADDRESS<<1;
-	g_i2c_tx_buf[1] = ((l_dac[1]>>8) & 0xF);
-	g_i2c_tx_buf[2] = (l_dac[1] & 0xFF);
-	g_i2c_tx_buf[3] = ((l_dac[3]>>8) & 0xF);
-	g_i2c_tx_buf[4] = (l_dac[3] & 0xFF);
-	g_i2c_tx_buf[5] = ((l_dac[2]>>8) & 0xF);
-	g_i2c_tx_buf[6] = (l_dac[2] & 0xFF);
-	g_i2c_tx_buf[7] = ((l_dac[0]>>8) & 0xF);
-	g_i2c_tx_buf[8] = (l_dac[0] & 0xFF);
-	g_i2c_tx_buf_len = 9;
+	if(count < 3) {
+		byte len = 1;
+		for(which=0; which<CV_MAX; ++which) {
+			if(dirty & (1<<which)) {
+				int value = l_dac[which];
+				g_i2c_tx_buf[len++] = 0b01000000 | (l_dac_chan[which]<<1); // multi-write, update now
+				g_i2c_tx_buf[len++] = 0b10010000 | ((value>>8) & 0xF); // internal vref, x2 gain
+				g_i2c_tx_buf[len++] = (value & 0xFF);
+			}
+		}
+		g_i2c_tx_buf_len = len;
+	}
+	else {
+		g_i2c_tx_buf[1] = ((l_dac[1]>>8) & 0xF);
+		g_i2c_tx_buf[2] = (l_dac[1] & 0xFF);
+		g_i2c_tx_buf[3] = ((l_dac[3]>>8) & 0xF);
+		g_i2c_tx_buf[4] = (l_dac[3] & 0xFF);
+		g_i2c_tx_buf[5] = ((l_dac[2]>>8) & 0xF);
+		g_i2c_tx_buf[6] = (l_dac[2] & 0xFF);
+		g_i2c_tx_buf[7] = ((l_dac[0]>>8) & 0xF);
+		g_i2c_tx_buf[8] = (l_dac[0] & 0xFF);
+		g_i2c_tx_buf_len = 9;
+	}
 	g_i2c_tx_buf_index = 0;
+	return 1;
 }
 
 ////////////////////////////////////////////////////////////
@@ -291,18 +697,51 @@ void cv_event(byte event, byte stack_id) {
 						while(note < 0) note += 12; 	
 						while(note > 120) note -= 12; 	
 						l_note[which_cv] = note;
+						cv_glide_to(which_cv, ((long)note<<8) + pstack->bend, 1);
 					}
-					// fall through
+					break;
 				case EV_BEND:
-					if(pcv->event.mode == CV_NOTE_HZV) {
-						cv_write_note_hzvolt(which_cv, l_note[which_cv], pstack->bend);
-					}
-					else if(pcv->event.mode == CV_NOTE_12VO) {
-						cv_write_note(which_cv, l_note[which_cv], pstack->bend, 600);
+					cv_glide_to(which_cv, ((long)l_note[which_cv]<<8) + pstack->bend, 0);
+					break;
+				case EV_NOTES_OFF:
+					l_note_held &= ~(1<<which_cv);
+					break;
+			}
+			break;
+		/////////////////////////////////////////////
+		// CV OUTPUT TIED TO ENVELOPE
+		case CV_ENV:
+		case CV_ENV_VEL:
+			switch(event) {
+				case EV_NOTE_ON:
+					// attack starts from the current level
+					l_note[which_cv] = pstack->vel;
+					l_env_stage[which_cv] = ENV_ATTACK;
+					break;
+				case EV_NOTES_OFF:
+					if(l_env_stage[which_cv] != ENV_IDLE) {
+						l_env_stage[which_cv] = ENV_RELEASE;
 					}
-					else {
-						cv_write_note(which_cv, l_note[which_cv], pstack->bend, 500);
+					break;
+			}
+			break;
+		/////////////////////////////////////////////
+		// CV OUTPUT TIED TO POLY AFTERTOUCH OF NOTE OUTPUT
+		case CV_POLY_TOUCH:
+			switch(event) {
+				case EV_NOTE_A:
+				case EV_NOTE_B:
+				case EV_NOTE_C:
+				case EV_NOTE_D:
+					if(pcv->event.out != event - EV_NOTE_A) {
+						break;
 					}
+					// fall thru
+				case EV_TOUCH:
+					cv_write_7bit(which_cv, pstack->touch[pcv->event.out], pcv->event.volts);
+					break;
+				case EV_NOTES_OFF:
+					cv_write_7bit(which_cv, 0, pcv->event.volts);
 					break;
 			}
 			break;
@@ -320,45 +759,149 @@ void cv_event(byte event, byte stack_id) {
 			break;
 		}
 	}
+	
+	// velocity as a modulation source
+	if(event >= EV_NOTE_A && event <= EV_NOTE_D) {
+		cv_mod_input(NRPVH_MOD_VEL, stack_id, (int)g_stack[stack_id].vel<<7);
+	}
+	
+	// note changes are sent to the DAC without waiting for 
+	// the next refresh, so that their gates are not held up
+	if(event >= EV_NOTE_A && event <= EV_NOTE_D && g_cv_dac_pending) {
+		g_cv_dac_urgent = 1;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// WRITE A 14-BIT CONTROLLER VALUE TO A CV OUTPUT
+// An MSB on an output that has seen LSBs holds back the DAC
+// commit for a short time, so that when the LSB follows 
+// straight after, both are sent in a single DAC write
+static void cv_write_14bit(byte which, byte value, byte is_lsb) {
+	byte bit = (1<<which);
+	byte curve = l_cv[which].midi.curve;
+	if(is_lsb) {
+		l_cc_14bit |= bit;
+		g_cv_dac_hold = 0;
+		byte msb = l_cc_msb[which];
+		if(curve != NRPVL_CURVE_LINEAR) {
+			if(msb < 127) {
+				// the LSB interpolates to the next curve entry 
+				int lo = cv_curve(curve, msb);
+				int hi = cv_curve(curve, msb + 1);
+				cv_write_smooth(which, ((((long)lo<<7) + (hi - lo) * value) * l_cv[which].midi.volts) >> 6);
+			}
+			else {
+				cv_write_7bit(which, msb, l_cv[which].midi.volts);
+			}
+			return;
+		}
+		cv_write_bend(which, (int)msb<<7|value, l_cv[which].midi.volts);
+	}
+	else {
+		// the LSB is zero until it is sent
+		l_cc_msb[which] = value;
+		if(l_cc_14bit & bit) {
+			g_cv_dac_hold = CC_LSB_WAIT_MS;
+		}
+		if(curve != NRPVL_CURVE_LINEAR) {
+			cv_write_7bit(which, value, l_cv[which].midi.volts);
+			return;
+		}
+		cv_write_bend(which, (int)value<<7, l_cv[which].midi.volts);
+	}
 }
 
 ////////////////////////////////////////////////////////////
 // HANDLE A MIDI CC
 void cv_midi_cc(byte chan, byte cc, byte value) {
-	for(byte which_cv=0; which_cv<CV_MAX; ++which_cv) {
+	if(chan == g_global.chan) {
+		cv_mod_input(NRPVH_MOD_CC, cc, (int)value<<7);
+	}
+	byte mask = l_cv_route[chan];
+	for(byte which_cv=0; mask; ++which_cv, mask>>=1) {
+		if(!(mask & 1)) {
+			continue;
+		}
 		CV_OUT *pcv = &l_cv[which_cv];
 	
 		// is this CV output configured for CC?
 		if(pcv->event.mode != CV_MIDI_CC) {
 			continue;
 		}		
-		// does the CC number match?
-		if(cc != pcv->midi.cc) {
+		// CC 0-31 are MSBs of 14-bit controllers, with
+		// the LSB on the CC number 32 higher
+		if(pcv->midi.cc < 32) {
+			if(cc == pcv->midi.cc) {
+				cv_write_14bit(which_cv, value, 0);
+			}
+			else if(cc == pcv->midi.cc + 32) {
+				cv_write_14bit(which_cv, value, 1);
+			}
+		}
+		else if(cc == pcv->midi.cc) {
+			cv_write_7bit(which_cv, value, pcv->event.volts);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// HANDLE NRPN DATA ENTRY
+// is_lsb is zero for data entry MSB (value is MSB) or 
+// nonzero for data entry LSB (value is LSB)
+void cv_midi_nrpn(byte chan, byte param_hi, byte param_lo, byte value, byte is_lsb) {
+	byte mask = l_cv_route[chan];
+	for(byte which_cv=0; mask; ++which_cv, mask>>=1) {
+		if(!(mask & 1)) {
 			continue;
 		}
-		// does MIDI channel match
-		if(!IS_CHAN(pcv->midi.chan,chan)) {
+		CV_OUT *pcv = &l_cv[which_cv];
+		if(pcv->event.mode != CV_MIDI_NRPN) {
 			continue;
 		}		
-		// OK update the output
-		cv_write_7bit(which_cv, value, pcv->event.volts);
+		if(param_hi != pcv->midi.nrpn_hi || param_lo != pcv->midi.cc) {
+			continue;
+		}
+		cv_write_14bit(which_cv, value, is_lsb);
 	}
 }
 
+////////////////////////////////////////////////////////////
+// CHECK IF A CC IS HALF OF A 14-BIT PAIR
+// Such CCs must not be coalesced, else an LSB could be 
+// applied to a stale MSB
+byte cv_cc_paired(byte cc) {
+	if(cc >= 64) {
+		return 0;
+	}
+	cc &= 0x1F;
+	for(byte which_cv=0; which_cv<CV_MAX; ++which_cv) {
+		if(l_cv[which_cv].event.mode == CV_MIDI_CC && 
+			l_cv[which_cv].midi.cc == cc &&
+			(l_cc_14bit & (1<<which_cv))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 // HANDLE MIDI AFTERTOUCH
 void cv_midi_touch(byte chan, byte value) {
-	for(byte which_cv=0; which_cv<CV_MAX; ++which_cv) {
+	if(chan == g_global.chan) {
+		cv_mod_input(NRPVH_MOD_TOUCH, 0, (int)value<<7);
+	}
+	byte mask = l_cv_route[chan];
+	for(byte which_cv=0; mask; ++which_cv, mask>>=1) {
+		if(!(mask & 1)) {
+			continue;
+		}
 		CV_OUT *pcv = &l_cv[which_cv];
 		
-		// is this CV output configured for CC?
+		// is this CV output configured for aftertouch?
 		if(pcv->event.mode != CV_MIDI_TOUCH) {
 			continue;
 		}		
-		// does MIDI channel match
-		if(!IS_CHAN(pcv->midi.chan,chan)) {
-			continue;
-		}		
 		// OK update the output
 		cv_write_7bit(which_cv, value, pcv->event.volts);
 	}
@@ -368,48 +911,346 @@ void cv_midi_touch(byte chan, byte value) {
 // HANDLE PITCH BEND
 void cv_midi_bend(byte chan, int value)
 {
-	for(byte which_cv=0; which_cv<CV_MAX; ++which_cv) {
+	if(chan == g_global.chan) {
+		cv_mod_input(NRPVH_MOD_BEND, 0, value - 8192);
+	}
+	byte mask = l_cv_route[chan];
+	for(byte which_cv=0; mask; ++which_cv, mask>>=1) {
+		if(!(mask & 1)) {
+			continue;
+		}
 		CV_OUT *pcv = &l_cv[which_cv];
 		if(pcv->event.mode != CV_MIDI_BEND) {
 			continue;
 		}		
-		// does MIDI channel match
-		if(!IS_CHAN(pcv->midi.chan,chan)) {
-			continue;
-		}		
 		cv_write_bend(which_cv, value, pcv->event.volts);		
 	}
 }					
 
 ////////////////////////////////////////////////////////////
-// HANDLE BPM
-// BPM is upscaled by 256
-/*
-void cv_midi_bpm(long value) {
-	if(value & (long)0xFFFF0000)
-		value = 0xFFFF;
+// HANDLE A MIDI CLOCK TICK
+// Only the tick period is measured and filtered here (using
+// shifts, no division). The outputs are updated from cv_run
+void cv_midi_tick(unsigned int time) {
+	// ignore the gap if the clock had stopped
+	if(l_bpm_gap < BPM_TIMEOUT_MS) {
+		long period = (long)(unsigned int)(time - l_bpm_last_tick) << 4;
+		if(!l_bpm_period) {
+			l_bpm_period = period;
+		}
+		else {
+			// low pass filter: period moves 1/8 of the way to new value
+			l_bpm_period += (period - l_bpm_period) >> 3;
+		}
+	}
+	l_bpm_last_tick = time;
+	l_bpm_gap = 0;
+	
+	// LFOs synced to clock lock their phase to the tick count,
+	// and step between ticks at the rate of the measured tempo
+	for(byte which=0; which<CV_MAX; ++which) {
+		CV_OUT *pcv = &l_cv[which];
+		if(pcv->lfo.mode != CV_LFO || !pcv->lfo.div) {
+			continue;
+		}
+		// the phase is set for this tick before counting it, so
+		// the cycle starts on the same tick as clock divider gates
+		l_glide_pos[which] = l_glide_step[which] * l_note[which];
+		if(++l_note[which] >= pcv->lfo.div) {
+			l_note[which] = 0;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// SET UP AN LFO SYNCED TO MIDI CLOCK
+// Works out the phase step per clock tick when the sync 
+// setting changes, so there is no division on each tick
+static void cv_lfo_sync(byte which) {
+	unsigned int div = l_cv[which].lfo.div;
+	l_glide_step[which] = div? (0x1000000L / div) : 0;
+	l_glide_target[which] = 0;
+	l_note[which] = 0;
+}
+
+////////////////////////////////////////////////////////////
+// UPDATE OUTPUTS IN MIDI CLOCK TEMPO MODE
+// Full range of the output (volts) is 256 BPM. The output
+// holds the last tempo when the clock stops. The phase step
+// per ms of LFOs synced to the clock is updated here too
+static void cv_bpm_update() {
+	if(!l_bpm_period) {
+		return;
+	}
+	// 24 ticks per beat at 2us per count, so 
+	// BPM = 60000000/(24*2*count) = 1250000/count
+	long bpm_x16 = 320000000L / l_bpm_period;
+	// a tick is (l_bpm_period/16) * 2us = l_bpm_period/8000 ms. The
+	// period is shifted down so the product fits in 32 bits
+	long period = l_bpm_period >> 8;
 	for(byte which_cv=0; which_cv<CV_MAX; ++which_cv) {
 		CV_OUT *pcv = &l_cv[which_cv];
+		if(pcv->lfo.mode == CV_LFO && pcv->lfo.div) {
+			if(period) {
+				l_glide_target[which_cv] = ((l_glide_step[which_cv] >> 8) * 8000) / period;
+			}
+			continue;
+		}
 		if(pcv->event.mode != CV_MIDI_BPM) {
 			continue;
 		}				
-		value *= (500 * pcv->event.volts);
-		cv_update(which_cv, value>>16);
+		// 1 volt is 500 clicks on the DAC
+		// DAC value = (BPM / 256) * (500 * volts)
+		cv_update(which_cv, (int)((bpm_x16 * 125 * pcv->event.volts) >> 10));
+	}
+}
+
+////////////////////////////////////////////////////////////
+// QUARTER SINE TABLE
+// 2047 * sin(index * 90 / 16 degrees)
+static int cv_lfo_sine_table(byte index) {
+	switch(index) {
+		case 0: return 0;
+		case 1: return 201;
+		case 2: return 399;
+		case 3: return 594;
+		case 4: return 783;
+		case 5: return 965;
+		case 6: return 1137;
+		case 7: return 1299;
+		case 8: return 1447;
+		case 9: return 1582;
+		case 10: return 1702;
+		case 11: return 1805;
+		case 12: return 1891;
+		case 13: return 1959;
+		case 14: return 2008;
+		case 15: return 2037;
+		default: return 2047;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// GET 12-BIT SINE LEVEL FOR A 16-BIT PHASE
+// The quarter table is mirrored for the other quarters and
+// interpolated between entries
+static int cv_lfo_sine(unsigned int phase) {
+	unsigned int q = phase & 0x3FFF;
+	if(phase & 0x4000) {
+		q = 0x3FFF - q;
+	}
+	byte index = q >> 10;
+	int lo = cv_lfo_sine_table(index);
+	int hi = cv_lfo_sine_table(index + 1);
+	int s = lo + (((long)(hi - lo) * ((q >> 2) & 0xFF)) >> 8);
+	return (phase & 0x8000) ? 2048 - s : 2048 + s;
+}
+
+////////////////////////////////////////////////////////////
+// WRITE LFO OUTPUT FOR A 16-BIT PHASE
+// wrapped is nonzero at the start of each cycle
+static void cv_lfo_write(byte which, unsigned int phase, byte wrapped) {
+	CV_OUT *pcv = &l_cv[which];
+	int level;	// 0-4095
+	switch(pcv->lfo.wave) {
+	case NRPVL_LFO_TRIANGLE:
+		level = (phase & 0x8000) ? (0xFFFF - phase) >> 3 : phase >> 3;
+		break;
+	case NRPVL_LFO_SAW:
+		level = phase >> 4;
+		break;
+	case NRPVL_LFO_SQUARE:
+		level = (phase & 0x8000) ? 0 : 4095;
+		break;
+	case NRPVL_LFO_SH:
+		if(!wrapped) {
+			return;
+		}
+		// 16-bit galois LFSR
+		if(l_lfo_random & 1) {
+			l_lfo_random = (l_lfo_random >> 1) ^ 0xB400;
+		}
+		else {
+			l_lfo_random >>= 1;
+		}
+		level = l_lfo_random & 0x0FFF;
+		break;
+	default:
+		level = cv_lfo_sine(phase);
+		break;
+	}
+	// 500 DAC counts per volt, so full level is 
+	// (level * volts * 500) / 4096. An LFO with zero
+	// volts can be used only as a modulation source
+	cv_mod_input(NRPVH_MOD_LFO, which, (level<<2) - 8192);
+	cv_update(which, ((long)level * pcv->lfo.volts * 125) >> 10);
+}
+
+////////////////////////////////////////////////////////////
+// RUN LFO OUTPUTS
+// Called once per ms
+static void cv_lfo_run() {
+	for(byte which=0; which<CV_MAX; ++which) {
+		CV_OUT *pcv = &l_cv[which];
+		if(pcv->lfo.mode != CV_LFO) {
+			continue;
+		}
+		long step;
+		if(pcv->lfo.div) {
+			// synced LFO holds when the clock stops
+			if(l_bpm_gap >= BPM_TIMEOUT_MS) {
+				continue;
+			}
+			step = l_glide_target[which];
+		}
+		else {
+			// rate 0 is about 8.7 minutes per cycle, 127 about 31Hz
+			step = (long)((int)(pcv->lfo.rate + 1) * (pcv->lfo.rate + 1)) << 5;
+		}
+		long phase = (l_glide_pos[which] + step) & LFO_PHASE_MASK;
+		l_glide_pos[which] = phase;
+		
+		// a new cycle starts when the phase leaves the second half
+		byte bit = (1<<which);
+		byte wrapped = 0;
+		if(phase & LFO_PHASE_HALF) {
+			l_lfo_high |= bit;
+		}
+		else if(l_lfo_high & bit) {
+			l_lfo_high &= ~bit;
+			wrapped = 1;
+		}
+		cv_lfo_write(which, (unsigned int)(phase >> 8), wrapped);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// RESTART LFOS ON MIDI START
+void cv_midi_start() {
+	for(byte which=0; which<CV_MAX; ++which) {
+		if(l_cv[which].lfo.mode == CV_LFO) {
+			l_glide_pos[which] = 0;
+			l_note[which] = 0;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// GET ENVELOPE SEGMENT COEFFICIENT
+// Each ms the level moves coef/32768 of the way to its target.
+// The time constant doubles every 10 steps of the time setting,
+// from 1ms at 0 to about 8s at 127. The table is 32767*2^(-i/10)
+static unsigned int cv_env_coef(byte time) {
+	byte shift = 0;
+	while(time >= 10) {
+		time -= 10;
+		++shift;
+	}
+	unsigned int coef;
+	switch(time) {
+		case 0: coef = 32767; break;
+		case 1: coef = 30573; break;
+		case 2: coef = 28525; break;
+		case 3: coef = 26615; break;
+		case 4: coef = 24833; break;
+		case 5: coef = 23170; break;
+		case 6: coef = 21618; break;
+		case 7: coef = 20170; break;
+		case 8: coef = 18820; break;
+		default: coef = 17559; break;
+	}
+	return coef >> shift;
+}
+
+////////////////////////////////////////////////////////////
+// RUN ENVELOPE OUTPUTS
+// Called once per ms
+static void cv_env_run() {
+	for(byte which=0; which<CV_MAX; ++which) {
+		CV_OUT *pcv = &l_cv[which];
+		if(pcv->env.mode != CV_ENV && pcv->env.mode != CV_ENV_VEL) {
+			continue;
+		}
+		byte stage = l_env_stage[which];
+		byte time;
+		long target;
+		switch(stage) {
+		case ENV_ATTACK:
+			time = pcv->env.attack;
+			target = ENV_ATTACK_TARGET;
+			break;
+		case ENV_DECAY:
+			time = pcv->env.decay;
+			target = ((long)pcv->env.sustain<<16) + ((long)pcv->env.sustain<<9); // 127 is ~ENV_PEAK
+			break;
+		case ENV_RELEASE:
+			time = pcv->env.release;
+			target = 0;
+			break;
+		default:
+			continue;
+		}
+		
+		// exponential segment
+		long level = l_glide_pos[which];
+		long step = (((target - level)>>8) * cv_env_coef(time)) >> 7;
+		if(step) {
+			level += step;
+		}
+		else {
+			level = target;
+		}
+		if(stage == ENV_ATTACK && level >= ENV_PEAK) {
+			level = ENV_PEAK;
+			l_env_stage[which] = ENV_DECAY;
+		}
+		else if(stage == ENV_RELEASE && level < 0x800) { // below 1 bit of 12-bit level
+			level = 0;
+			l_env_stage[which] = ENV_IDLE;
+		}
+		l_glide_pos[which] = level;
+		
+		// 12-bit level, optionally scaled by velocity. The DAC 
+		// is only written when the resulting value changes
+		int value = level >> 11;
+		if(pcv->env.mode == CV_ENV_VEL) {
+			value = ((long)value * (l_note[which] + 1)) >> 7;
+		}
+		cv_update(which, ((long)value * pcv->env.volts * 125) >> 10);
 	}
 }
-*/
+
 ////////////////////////////////////////////////////////////
 // CONFIGURE A CV OUTPUT
 // return nonzero if any change was made
 byte cv_nrpn(byte which_cv, byte param_lo, byte value_hi, byte value_lo) 
 {
-	if(which_cv>CV_MAX)
+	if(which_cv>=CV_MAX)
 		return 0;
 	CV_OUT *pcv = &l_cv[which_cv];
 	
+	// any glide or smoothing in progress finishes at its target,
+	// so the output is not left partway. Mode and calibration 
+	// are baked into the note table
+	if(l_gliding & (1<<which_cv)) {
+		l_glide_pos[which_cv] = l_glide_target[which_cv];
+		cv_write_pitch(which_cv, l_glide_target[which_cv]>>8);
+		l_gliding &= ~(1<<which_cv);
+	}
+	if(l_slewing & (1<<which_cv)) {
+		l_glide_pos[which_cv] = l_glide_target[which_cv];
+		cv_update(which_cv, (int)(l_glide_target[which_cv]>>16));
+		l_slewing &= ~(1<<which_cv);
+	}
+	l_note_table_stale |= (1<<which_cv);
+	
+	// 14-bit controller detection starts over
+	l_cc_14bit &= ~(1<<which_cv);
+	
 	switch(param_lo) {
 	// SELECT SOURCE
 	case NRPNL_SRC:
+		l_glide_from &= ~(1<<which_cv);
 		switch(value_hi) {				
 		case NRPVH_SRC_DISABLE:	// DISABLE
 			cv_write_volts(which_cv, 0); 
@@ -428,16 +1269,41 @@ byte cv_nrpn(byte which_cv, byte param_lo, byte value_hi, byte value_lo)
 			pcv->midi.chan = CHAN_GLOBAL;
 			pcv->midi.cc = value_lo;
 			pcv->midi.volts = DEFAULT_CV_CC_MAX_VOLTS;
+			pcv->midi.slew = 0;
+			pcv->midi.curve = NRPVL_CURVE_LINEAR;
 			return 1;					
+		case NRPVH_SRC_MIDINRPN: // NRPN 
+			pcv->event.mode = CV_MIDI_NRPN;
+			pcv->midi.chan = CHAN_GLOBAL;
+			pcv->midi.cc = value_lo;
+			pcv->midi.nrpn_hi = 0;
+			pcv->midi.volts = DEFAULT_CV_CC_MAX_VOLTS;
+			pcv->midi.slew = 0;
+			pcv->midi.curve = NRPVL_CURVE_LINEAR;
+			return 1;					
+		case NRPVH_SRC_LFO: // LFO
+			if(value_lo <= NRPVL_LFO_SH) {
+				pcv->lfo.mode = CV_LFO;
+				pcv->lfo.volts = DEFAULT_CV_LFO_MAX_VOLTS;
+				pcv->lfo.wave = value_lo;
+				pcv->lfo.rate = DEFAULT_LFO_RATE;
+				pcv->lfo.div = 0;
+				l_glide_pos[which_cv] = 0;
+				return 1;
+			}
+			break;
 		case NRPVH_SRC_MIDITOUCH: // AFTERTOUCH
 			pcv->event.mode = CV_MIDI_TOUCH;
 			pcv->midi.chan = CHAN_GLOBAL;
 			pcv->midi.volts = DEFAULT_CV_TOUCH_MAX_VOLTS;
+			pcv->midi.slew = 0;
+			pcv->midi.curve = NRPVL_CURVE_LINEAR;
 			return 1;					
 		case NRPVH_SRC_MIDIBEND: // PITCHBEND
 			pcv->event.mode = CV_MIDI_BEND;
 			pcv->midi.chan = CHAN_GLOBAL;
 			pcv->midi.volts = DEFAULT_CV_PB_MAX_VOLTS;
+			pcv->midi.slew = 0;
 			return 1;					
 		case NRPVH_SRC_STACK1: // NOTE STACK 
 		case NRPVH_SRC_STACK2:
@@ -452,10 +1318,32 @@ byte cv_nrpn(byte which_cv, byte param_lo, byte value_hi, byte value_lo)
 				pcv->event.mode = CV_NOTE;
 				pcv->event.out = value_lo - NRPVL_SRC_NOTE1;
 				pcv->event.transpose = TRANSPOSE_NONE;
+				pcv->event.glide = 0;	// shared with slew setting of MIDI modes
 				return 1;				
 			case NRPVL_SRC_VEL:		// NOTE VELOCITY
 				pcv->event.mode = CV_VEL;
 				pcv->event.volts = DEFAULT_CV_VEL_MAX_VOLTS;
+				pcv->midi.curve = NRPVL_CURVE_LINEAR;
+				return 1;
+			case NRPVL_SRC_TOUCH1:	// NOTE POLY AFTERTOUCH
+			case NRPVL_SRC_TOUCH2:
+			case NRPVL_SRC_TOUCH3:
+			case NRPVL_SRC_TOUCH4:
+				pcv->event.mode = CV_POLY_TOUCH;
+				pcv->event.out = value_lo - NRPVL_SRC_TOUCH1;
+				pcv->event.volts = DEFAULT_CV_TOUCH_MAX_VOLTS;
+				pcv->midi.curve = NRPVL_CURVE_LINEAR;
+				return 1;
+			case NRPVL_SRC_ENV:		// ENVELOPE
+			case NRPVL_SRC_ENV_VEL:
+				pcv->env.mode = (value_lo == NRPVL_SRC_ENV) ? CV_ENV : CV_ENV_VEL;
+				pcv->env.volts = DEFAULT_CV_ENV_MAX_VOLTS;
+				pcv->env.attack = DEFAULT_ENV_ATTACK;
+				pcv->env.decay = DEFAULT_ENV_DECAY;
+				pcv->env.sustain = DEFAULT_ENV_SUSTAIN;
+				pcv->env.release = DEFAULT_ENV_RELEASE;
+				l_env_stage[which_cv] = ENV_IDLE;
+				l_glide_pos[which_cv] = 0;
 				return 1;
 		}
 		}
@@ -480,6 +1368,112 @@ byte cv_nrpn(byte which_cv, byte param_lo, byte value_hi, byte value_lo)
 		}
 		break;		
 		
+	// SELECT RESPONSE CURVE
+	// The settings below share bytes with other modes, so 
+	// are only taken when the output is in a mode they apply to
+	case NRPNL_CURVE:
+		switch(pcv->midi.mode) {
+		case CV_MIDI_CC:
+		case CV_MIDI_NRPN:
+		case CV_MIDI_TOUCH:
+		case CV_VEL:
+		case CV_POLY_TOUCH:
+			if(value_lo <= NRPVL_CURVE_S) {
+				pcv->midi.curve = value_lo;
+				return 1;
+			}
+			break;
+		}
+		break;
+
+	// SELECT SMOOTHING
+	case NRPNL_SLEW:
+		switch(pcv->midi.mode) {
+		case CV_MIDI_CC:
+		case CV_MIDI_NRPN:
+		case CV_MIDI_TOUCH:
+		case CV_MIDI_BEND:
+			if(value_lo <= SLEW_MAX) {
+				pcv->midi.slew = value_lo;
+				return 1;
+			}
+			break;
+		}
+		break;
+
+	// SELECT MODULATION SOURCE AND DEPTH
+	case NRPNL_MOD1_SRC:
+	case NRPNL_MOD2_SRC:
+		switch(value_hi) {
+		case NRPVH_MOD_NONE:
+		case NRPVH_MOD_TOUCH:
+		case NRPVH_MOD_BEND:
+			value_lo = 0;
+			break;
+		case NRPVH_MOD_VEL:
+		case NRPVH_MOD_LFO:
+			if(value_lo > 3) {
+				return 0;
+			}
+			break;
+		case NRPVH_MOD_CC:
+			break;
+		default:
+			return 0;
+		}
+		l_cv_mod[which_cv][(param_lo - NRPNL_MOD1_SRC)>>1].key = MOD_KEY(value_hi, value_lo);
+		return 1;
+	case NRPNL_MOD1_DEPTH:
+	case NRPNL_MOD2_DEPTH:
+		l_cv_mod[which_cv][(param_lo - NRPNL_MOD1_SRC)>>1].depth = value_lo;
+		return 1;
+		
+	// SELECT ENVELOPE SEGMENT TIME OR SUSTAIN LEVEL
+	case NRPNL_ENV:
+		if(pcv->env.mode != CV_ENV && pcv->env.mode != CV_ENV_VEL) {
+			break;
+		}
+		switch(value_hi) {
+		case NRPVH_ENV_ATTACK:
+			pcv->env.attack = value_lo;
+			return 1;
+		case NRPVH_ENV_DECAY:
+			pcv->env.decay = value_lo;
+			return 1;
+		case NRPVH_ENV_SUSTAIN:
+			pcv->env.sustain = value_lo;
+			return 1;
+		case NRPVH_ENV_RELEASE:
+			pcv->env.release = value_lo;
+			return 1;
+		}
+		break;
+		
+	// SELECT LFO RATE
+	case NRPNL_LFO_RATE:
+		if(pcv->lfo.mode != CV_LFO) {
+			break;
+		}
+		pcv->lfo.rate = value_lo;
+		return 1;
+		
+	// SELECT LFO SYNC (MIDI CLOCK TICKS PER CYCLE, 0 = FREE RUNNING)
+	case NRPNL_LFO_SYNC:
+		if(pcv->lfo.mode != CV_LFO) {
+			break;
+		}
+		pcv->lfo.div = (unsigned int)value_hi<<7|value_lo;
+		cv_lfo_sync(which_cv);
+		return 1;
+
+	// SELECT NRPN PARAM HIGH BYTE
+	case NRPNL_NRPN_HI:
+		if(pcv->midi.mode != CV_MIDI_NRPN) {
+			break;
+		}
+		pcv->midi.nrpn_hi = value_lo;
+		return 1;
+		
 	// SELECT TRANSPOSE AMOUNT
 	case NRPNL_TRANSPOSE:
 		pcv->event.transpose = value_lo; 
@@ -493,6 +1487,15 @@ byte cv_nrpn(byte which_cv, byte param_lo, byte value_hi, byte value_lo)
 		}
 		break;	
 
+	// SELECT GLIDE
+	case NRPNL_GLIDE_TIME:
+		if(value_hi <= NRPVH_GLIDE_RATE_LEGATO) {
+			pcv->event.glide_mode = value_hi;	// NRPVH_GLIDE_xxx values map to GLIDE_xxx bits
+			pcv->event.glide = value_lo;
+			return 1;
+		}
+		break;
+
 	// SELECT PITCH SCHEME
 	case NRPNL_PITCH_SCHEME:
 		if(value_lo == NRPVH_PITCH_HZV) {
@@ -513,10 +1516,99 @@ byte cv_nrpn(byte which_cv, byte param_lo, byte value_hi, byte value_lo)
 	case NRPNL_CAL_OFS:
 		pcv->event.ofs = value_lo;
 		return 1;		
+	case NRPNL_CAL_POINT:	// value_hi is octave
+		if(value_hi < NOTE_OCTAVES) {
+			l_cal_point[which_cv][value_hi] = value_lo;
+			return 1;
+		}
+		break;
 	}
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+// BUILD ROUTING TABLE FROM CV CONFIG
+void cv_route() {
+	// modulation sources listen on the global channel
+	byte was_active = l_mod_active;
+	l_mod_active = 0;
+	l_mod_filter = 0;
+	for(byte which_cv=0; which_cv<CV_MAX; ++which_cv) {
+		for(byte slot=0; slot<CV_MOD_MAX; ++slot) {
+			switch(MOD_SRC(l_cv_mod[which_cv][slot].key)) {
+			case NRPVH_MOD_NONE:
+				continue;
+			case NRPVH_MOD_CC:
+				l_mod_filter |= MIDI_FILTER_CC;
+				break;
+			case NRPVH_MOD_TOUCH:
+				l_mod_filter |= MIDI_FILTER_TOUCH;
+				break;
+			case NRPVH_MOD_BEND:
+				l_mod_filter |= MIDI_FILTER_BEND;
+				break;
+			}
+			l_mod_active |= (1<<which_cv);
+		}
+		// an output that was not modulated holds its base value
+		if((l_mod_active & ~was_active) & (1<<which_cv)) {
+			l_mod_base[which_cv] = l_dac[which_cv];
+		}
+	}
+	
+	for(byte chan=0; chan<16; ++chan) {
+		byte mask = 0;
+		for(byte which_cv=0; which_cv<CV_MAX; ++which_cv) {
+			CV_OUT *pcv = &l_cv[which_cv];
+			switch(pcv->midi.mode) {
+			case CV_MIDI_CC:
+			case CV_MIDI_NRPN:
+			case CV_MIDI_TOUCH:
+			case CV_MIDI_BEND:
+				if(IS_CHAN(pcv->midi.chan, chan)) {
+					mask |= (1<<which_cv);
+				}
+				break;
+			}
+		}
+		l_cv_route[chan] = mask;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// GET MIDI INPUT FILTER BITS FOR A CHANNEL
+byte cv_filter(byte chan) {
+	byte filter = 0;
+	byte mask = l_cv_route[chan];
+	for(byte which_cv=0; mask; ++which_cv, mask>>=1) {
+		if(mask & 1) {
+			switch(l_cv[which_cv].midi.mode) {
+			case CV_MIDI_CC:
+			case CV_MIDI_NRPN:
+				filter |= MIDI_FILTER_CC;
+				break;
+			case CV_MIDI_TOUCH:
+				filter |= MIDI_FILTER_TOUCH;
+				break;
+			case CV_MIDI_BEND:
+				filter |= MIDI_FILTER_BEND;
+				break;
+			}
+		}
+	}
+	if(chan == g_global.chan) {
+		filter |= l_mod_filter;
+	}
+	// poly aftertouch outputs listen on the channel of their stack
+	for(byte which_cv=0; which_cv<CV_MAX; ++which_cv) {
+		CV_OUT *pcv = &l_cv[which_cv];
+		if(pcv->event.mode == CV_POLY_TOUCH && IS_CHAN(g_stack_cfg[pcv->event.stack_id].chan, chan)) {
+			filter |= MIDI_FILTER_POLY_TOUCH;
+		}
+	}
+	return filter;
+}
+
 ////////////////////////////////////////////////////////////
 // GET CV CONFIG
 byte *cv_storage(int *len) {
@@ -524,12 +1616,53 @@ byte *cv_storage(int *len) {
 	return (byte*)&l_cv;
 }
 
+////////////////////////////////////////////////////////////
+// GET CV MODULATION CONFIG
+byte *cv_mod_storage(int *len) {
+	*len = sizeof(l_cv_mod);
+	return (byte*)&l_cv_mod;
+}
+
+////////////////////////////////////////////////////////////
+// GET CV CALIBRATION POINTS
+byte *cv_cal_storage(int *len) {
+	*len = sizeof(l_cal_point);
+	return (byte*)&l_cal_point;
+}
+
 ////////////////////////////////////////////////////////////
 // INITIALISE CV MODULE
 void cv_init() {
 	memset(l_cv, 0, sizeof(l_cv));
 	memset(l_dac, 0, sizeof(l_dac));
+	memset(l_dac_front, 0xFF, sizeof(l_dac_front));
 	memset(l_note, 0, sizeof(l_note));
+	memset(l_cv_route, 0, sizeof(l_cv_route));
+	memset(l_cal_point, 64, sizeof(l_cal_point));
+	memset(l_cc_msb, 0, sizeof(l_cc_msb));
+	l_cc_14bit = 0;
+	l_note_table_stale = 0x0F;	// build when first used
+	memset(l_glide_pos, 0, sizeof(l_glide_pos));
+	l_glide_tick = 0;
+	l_gliding = 0;
+	l_glide_from = 0;
+	l_slewing = 0;
+	l_lfo_high = 0;
+	l_lfo_random = 0xACE1;
+	memset(l_env_stage, ENV_IDLE, sizeof(l_env_stage));
+	for(byte which=0; which<CV_MAX; ++which) {
+		for(byte slot=0; slot<CV_MOD_MAX; ++slot) {
+			l_cv_mod[which][slot].key = MOD_KEY(NRPVH_MOD_NONE, 0);
+			l_cv_mod[which][slot].depth = MOD_DEPTH_NONE;
+		}
+	}
+	memset(l_mod_value, 0, sizeof(l_mod_value));
+	memset(l_mod_base, 0, sizeof(l_mod_base));
+	l_mod_active = 0;
+	l_mod_filter = 0;
+	l_bpm_period = 0;
+	l_bpm_gap = BPM_STOPPED;
+	l_bpm_timer = 0;
 	cv_config_dac();
 	
 	/*l_cv[0].event.mode = CV_NOTE;
@@ -543,8 +1676,72 @@ void cv_init() {
 	*/
 }
 
+////////////////////////////////////////////////////////////
+// RUN GLIDES AND TEMPO OUTPUTS
+// Called once per ms. The DAC is only updated every few ms 
+// so gliding outputs leave time on the I2C bus for new notes
+void cv_run() {
+	// time since last clock tick
+	if(l_bpm_gap < BPM_STOPPED) {
+		++l_bpm_gap;
+	}
+	// tempo outputs change slowly so are updated infrequently
+	if(++l_bpm_timer >= BPM_UPDATE_MS) {
+		l_bpm_timer = 0;
+		cv_bpm_update();
+	}
+	cv_lfo_run();
+	cv_env_run();
+	
+	// smoothed MIDI controller outputs move a fraction 1/2^slew
+	// of the remaining distance each ms (a one-pole low pass
+	// with time constant about 2^slew ms)
+	byte mask = l_slewing;
+	for(byte which=0; mask; ++which, mask>>=1) {
+		if(!(mask & 1)) {
+			continue;
+		}
+		long pos = l_glide_pos[which];
+		long diff = l_glide_target[which] - pos;
+		if(diff > -65536 && diff < 65536) {
+			// within a DAC count so finish the move
+			pos = l_glide_target[which];
+			l_slewing &= ~(1<<which);
+		}
+		else {
+			pos += diff >> l_cv[which].midi.slew;
+		}
+		l_glide_pos[which] = pos;
+		cv_update(which, (int)(pos>>16));
+	}
+	
+	if(++l_glide_tick < GLIDE_UPDATE_MS) {
+		return;
+	}
+	l_glide_tick = 0;
+	mask = l_gliding;
+	for(byte which=0; mask; ++which, mask>>=1) {
+		if(!(mask & 1)) {
+			continue;
+		}
+		long step = l_glide_step[which];
+		long pos = l_glide_pos[which] + step;
+		long target = l_glide_target[which];
+		if((step > 0 && pos >= target) || (step < 0 && pos <= target)) {
+			pos = target;
+			l_gliding &= ~(1<<which);
+		}
+		l_glide_pos[which] = pos;
+		cv_write_pitch(which, pos>>8);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 void cv_reset() {
+	l_gliding = 0;
+	l_glide_from = 0;
+	memset(l_mod_value, 0, sizeof(l_mod_value));
+	l_note_held = 0;
 	for(byte which=0; which < CV_MAX; ++which) {
 		switch(l_cv[which].event.mode) {				
 		case CV_TEST:	
@@ -553,11 +1750,22 @@ void cv_reset() {
 		case CV_MIDI_BEND: 
 			cv_write_bend(which, 8192, l_cv[which].event.volts); // set half full volts
 			break;
+		case CV_ENV:
+		case CV_ENV_VEL:
+			l_env_stage[which] = ENV_IDLE;
+			l_glide_pos[which] = 0;
+			cv_write_volts(which, 0); 
+			break;
+		case CV_LFO:
+			cv_lfo_sync(which);
+			cv_write_volts(which, 0); 
+			break;
 		default:
 			cv_write_volts(which, 0); 
 			break;
 		}
 	}
+	memset(l_dac_front, 0xFF, sizeof(l_dac_front));
 	g_cv_dac_pending = 1;
 }
 
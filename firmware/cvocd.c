@@ -51,48 +51,187 @@ enum {
 	SYSEX_ID0,		// expect first byte of id
 	SYSEX_ID1,		// expect second byte of id
 	SYSEX_ID2,		// expect third byte of id
+	SYSEX_DEVICE,	// expect device id
 	SYSEX_PARAMH,	// expect high byte of a param number
 	SYSEX_PARAML,	// expect low byte of a param number
 	SYSEX_VALUEH,	// expect high byte of a param value
 	SYSEX_VALUEL	// expect low byte of a param value
 };
 
+// A complete MIDI message as parsed by the receive interrupt
+typedef struct {
+	byte status;			// status byte (including channel)
+	byte params[2];			// data bytes
+	unsigned int time;		// timer 1 count when received
+} MIDI_EVENT;
+
+// A MIDI realtime message with its time of arrival
+typedef struct {
+	byte msg;				// realtime status byte
+	unsigned int time;		// timer 1 count when received
+} RT_EVENT;
+
+// Classes of message for which latency is measured
+enum {
+	LAT_NOTE,		// note on/off
+	LAT_CC,			// CC, pitch bend and aftertouch
+	LAT_CLOCK,		// realtime clock messages
+	LAT_MAX,
+	LAT_NONE = 0xFF	// no message waiting on an output
+};
+
+// Outputs with nothing pending before a message is dispatched
+#define LAT_IDLE_DAC	0x01
+#define LAT_IDLE_SR		0x02
+
+// Latency statistics kept for each class of message. All times
+// are in timer 1 counts (2us). Histogram bucket 0 is < 128us 
+// and each further bucket doubles the limit (the last bucket 
+// collects everything over 8ms). Histogram counts are bytes, and
+// when one would overflow all the counts of that class are halved,
+// so the histogram keeps the proportions of the latencies seen
+#define LAT_HIST_BUCKETS	8
+enum {
+	STAT_LAT_MIN,
+	STAT_LAT_MAX,
+	STAT_LAT_HIST,
+	STAT_LAT_FIELDS = STAT_LAT_HIST + LAT_HIST_BUCKETS
+};
+
+// Receive statistics, reported after the latency statistics
+enum {
+	STAT_RX_DROPPED,	// controller messages dropped or merged because the queue was filling
+	STAT_RX_LOST,		// other messages lost because the queue was full
+	STAT_RX_COALESCED,	// controller messages skipped because a newer value was waiting
+	STAT_RX_OVERRUNS,	// UART overrun errors
+	STAT_RX_PEAK,		// highest number of messages waiting in the queue
+	STAT_RT_LOST,		// realtime messages lost because the realtime queue was full
+	STAT_TX_LOST,		// THRU bytes lost because the transmit buffer was full
+	STAT_RX_FIELDS
+};
+
+// LED feedback sequences played after a sysex block
+enum {
+	LED_SEQ_COMMIT,		// both LEDs on for 1s (patch accepted)
+	LED_SEQ_ERROR		// LED2 blinks 10 times (bad sysex data)
+};
+
 //
 // LOCAL DATA
 //
 
-// define the buffer used to receive MIDI input
-#define SZ_RXBUFFER 			64		// size of MIDI receive buffer (power of 2)
-#define SZ_RXBUFFER_MASK 		0x3F	// mask to keep an index within range of buffer
-volatile byte rx_buffer[SZ_RXBUFFER];	// the MIDI receive buffer
-volatile byte rx_head = 0;				// buffer data insertion index
-volatile byte rx_tail = 0;				// buffer data retrieval index
+// Read the free running timer 1, allowing for the low 
+// byte rolling over between the two reads
+#define TIMER1_READ(t) { \
+	byte _hi = tmr1h; byte _lo = tmr1l; \
+	if(_hi != tmr1h) { _hi = tmr1h; _lo = tmr1l; } \
+	(t) = (unsigned int)_hi<<8|_lo; }
+
+// Pseudo status bytes used to pass sysex data from the receive interrupt
+// to the main loop (0xF4 and 0xF5 are undefined in MIDI so cannot clash 
+// with anything we receive)
+#define RX_SYSEX_DATA			0xF4	// sysex payload byte in params[0]
+#define RX_SYSEX_ABORT			0xF5	// sysex block cut short by a status byte
+
+// define the queue of parsed messages received from MIDI input. Each
+// entry takes 5 bytes so the queue uses 120 bytes of RAM, which holds 
+// about 22ms of 3 byte messages at the full MIDI data rate. When the queue 
+// starts to fill, the last entries are kept for the messages that must 
+// not be lost (e.g. note off and sysex data)
+#define SZ_RXQUEUE 				24		// size of MIDI event queue
+#define RX_RESERVE_CTRL			8		// entries kept free of CC, bend and aftertouch
+#define RX_RESERVE_NOTE			2		// entries kept free of note on
+#define RX_NEXT(i) 				(((i) >= SZ_RXQUEUE - 1)? 0 : (i) + 1)	
+volatile MIDI_EVENT rx_queue[SZ_RXQUEUE];	// the MIDI event queue
+volatile byte rx_head = 0;				// queue insertion index
+volatile byte rx_tail = 0;				// queue retrieval index
+volatile unsigned int rx_stats[STAT_RX_FIELDS];	// receive statistics
 
-// State flags used while receiving MIDI data
-byte midi_status = 0;					// current MIDI message status (running status)
-byte midi_num_params = 0;				// number of parameters needed by current MIDI message
+// define the queue of MIDI realtime (clock) messages. These bypass the 
+// main receive queue so they are not held up behind other messages
+#define SZ_RTQUEUE 				8		// size of realtime queue (power of 2)
+#define SZ_RTQUEUE_MASK 		0x07	// mask to keep an index within range of queue
+volatile RT_EVENT rt_queue[SZ_RTQUEUE];	// the realtime message queue
+volatile byte rt_head = 0;				// queue insertion index
+volatile byte rt_tail = 0;				// queue retrieval index
+
+// State used by the receive interrupt while parsing MIDI data
+byte rx_status = 0;						// current MIDI message status (running status)
+byte rx_num_params = 0;					// number of parameters needed by current MIDI message
+byte rx_params[2];						// parameter values of current MIDI message
+byte rx_param = 0;						// number of params currently received
+byte rx_sysex = SYSEX_NONE;				// whether we are currently inside a sysex block
+
+// define the buffer used to transmit MIDI output
+#define SZ_TXBUFFER 			16		// size of MIDI transmit buffer (power of 2)
+#define SZ_TXBUFFER_MASK 		0x0F	// mask to keep an index within range of buffer
+volatile byte tx_buffer[SZ_TXBUFFER];	// the MIDI transmit buffer
+volatile byte tx_head = 0;				// buffer data insertion index
+volatile byte tx_tail = 0;				// buffer data retrieval index
+volatile byte tx_realtime = 0;			// realtime byte to send ahead of the buffer (0 if none)
+
+// State used by the receive interrupt for soft MIDI THRU
+#define THRU_SYSEX				0xFF	// thru_len for a sysex block (no fixed length)
+byte thru_in_status = 0;				// running status of input (0 if none)
+byte thru_out_status = 0;				// running status of output (0 if none)
+byte thru_len = 0;						// number of data bytes in current message
+byte thru_count = 0;					// number of data bytes received so far
+byte thru_pass = 0;						// whether current message is being passed
+volatile byte thru_busy = 0;			// set while part of a message has been passed
+
+// State used by the main loop 
 byte midi_params[2];					// parameter values of current MIDI message
-char midi_param = 0;					// number of params currently received
+unsigned int midi_time = 0;				// arrival time of current MIDI message
+byte sysex_changes = 0;					// whether current sysex block changed any config
 byte midi_ticks = 0;					// number of MIDI clock ticks received
+unsigned int midi_clock_time = 0;		// arrival time of the realtime message being handled
 byte sysex_state = SYSEX_NONE;			// whether we are currently inside a sysex block
 
 // Timer related stuff
 #define TIMER_0_INIT_SCALAR		5		// Timer 0 initialiser to overlow at 1ms intervals
 volatile byte ms_tick = 0;				// once per millisecond tick flag used to synchronise stuff
-//volatile int millis = 0;				// millisecond counter
+byte dac_timer = 0;						// ms until the next DAC refresh is allowed
 
 byte nrpn_hi = 0;						// value of last NRPN param high byte			
 byte nrpn_lo = 0;						// value of last NRPN param low byte
 byte nrpn_value_hi = 0;					// value of last NRPN value high byte
+byte route_pending = 1;					// set when routing tables need to be rebuilt
+
+// MIDI input filter: for each channel, the MIDI_FILTER_xxx bits for the
+// message types that the current patch listens to
+volatile byte g_midi_filter[16];
+
+// Latency measurement
+unsigned int lat_range[LAT_MAX][STAT_LAT_HIST];	// min and max latency per message class
+byte lat_hist[LAT_MAX][LAT_HIST_BUCKETS];		// latency histogram per message class
+byte lat_dac_class = LAT_NONE;			// class of oldest message waiting on DAC data
+unsigned int lat_dac_time;				// ..and its arrival time
+byte lat_i2c_class = LAT_NONE;			// class of oldest message in the DAC transfer underway
+unsigned int lat_i2c_time;				// ..and its arrival time
+byte lat_sr_class = LAT_NONE;			// class of oldest message waiting on gate data
+unsigned int lat_sr_time;				// ..and its arrival time
+byte lat_idle;							// LAT_IDLE_xxx bits taken before dispatch
+
+// Statistics report
+#define REPORT_IDLE				0xFF	// no report being sent
+byte report_param = REPORT_IDLE;		// next statistic to send in report
+
+// LED feedback sequence
+byte led_seq = LED_SEQ_COMMIT;			// which sequence is playing
+byte led_seq_count = 0;					// number of steps left to play (0 when idle)
+byte led_seq_timer = 0;					// ms left in current step
 
 //
 // GLOBAL DATA
 //
 volatile byte g_cv_dac_pending;				// flag to say whether dac data is pending
+byte g_cv_dac_urgent = 0;					// flag to send dac data without waiting for refresh
+byte g_cv_dac_hold = 0;						// ms to hold dac data waiting for a 14-bit LSB
 volatile unsigned int g_sr_data = 0;		// gate data to load to shift registers
 volatile unsigned int g_sr_retrigs = 0;		// shift register bits to send low before next load
 volatile byte g_sr_data_pending = 0;		// indicates if any gate data is pending
 volatile unsigned int g_sync_sr_data = 0;	// additional gate bits, synced to CV load
+volatile unsigned int g_sync_sr_armed = 0;	// synced gate bits waiting on the DAC transfer underway
 volatile byte g_sync_sr_data_pending = 0;	// indicates if any synched gate data is pending
 
 volatile byte g_i2c_tx_buf[I2C_TX_BUF_SZ];	// transmit buffer for i2c
@@ -102,6 +241,220 @@ volatile byte g_i2c_tx_buf_len = 0;			// total number of bytes in buffer
 byte g_led_1_timeout = 0;					// ms after which LED1 is turned off
 byte g_led_2_timeout = 0;					// ms after which LED1 is turned off
 
+////////////////////////////////////////////////////////////
+// ADD A MESSAGE TO THE RECEIVE QUEUE
+// Called from the interrupt service routine only
+static void rx_push(byte status, byte param0, byte param1)
+{
+	byte i;
+	
+	// how many messages are already waiting?
+	byte count = (rx_head >= rx_tail)? 
+		(rx_head - rx_tail) : (rx_head + SZ_RXQUEUE - rx_tail);
+	if(count > rx_stats[STAT_RX_PEAK]) {
+		rx_stats[STAT_RX_PEAK] = count;
+	}
+		
+	// how much of the queue is this message allowed to use?
+	byte limit = SZ_RXQUEUE - 1;
+	byte is_ctrl = 0;
+	switch(status & 0xF0) {
+	case 0x90: 
+		if(param1) { // note on
+			limit = SZ_RXQUEUE - RX_RESERVE_NOTE;
+		}
+		break;
+	case 0xB0:
+		switch(param0) {
+		case MIDI_CC_NRPN_HI: // NRPN config must not be lost
+		case MIDI_CC_NRPN_LO:
+		case MIDI_CC_DATA_HI:
+		case MIDI_CC_DATA_LO:
+			break;
+		default:
+			is_ctrl = 1;
+			break;
+		}
+		break;
+	case 0xA0:
+	case 0xD0:
+	case 0xE0:
+		is_ctrl = 1;
+		break;
+	}
+	if(is_ctrl) {
+		limit = SZ_RXQUEUE - RX_RESERVE_CTRL;
+	}
+	
+	if(count >= limit) {
+		if(is_ctrl) {
+			// a controller value that does not fit can still replace an older 
+			// value for the same controller (or the same note, for poly pressure)
+			// that is waiting (the entry at the tail is skipped as the main loop 
+			// may be reading it)
+			++rx_stats[STAT_RX_DROPPED];
+			for(i = RX_NEXT(rx_tail); i != rx_head; i = RX_NEXT(i)) {
+				if(rx_queue[i].status == status && 
+					(((status & 0xF0) != 0xB0 && (status & 0xF0) != 0xA0) || 
+						rx_queue[i].params[0] == param0)) {
+					rx_queue[i].params[1] = param1;
+					rx_queue[i].params[0] = param0;
+					TIMER1_READ(rx_queue[i].time);
+					break;
+				}
+			}
+		}
+		else {
+			++rx_stats[STAT_RX_LOST];
+		}
+		return;
+	}
+	
+	i = rx_head;
+	rx_queue[i].status = status;
+	rx_queue[i].params[0] = param0;
+	rx_queue[i].params[1] = param1;
+	TIMER1_READ(rx_queue[i].time);
+	rx_head = RX_NEXT(i);
+}
+
+////////////////////////////////////////////////////////////
+// PASS A THRU BYTE TO THE MIDI OUTPUT
+// Called from the interrupt service routine, or with interrupts
+// disabled. When the UART is idle the byte goes straight to the 
+// transmit register. A realtime byte can be sent ahead of 
+// anything waiting in the buffer so clock is not held up
+static void tx_put(byte b)
+{
+	if(tx_head == tx_tail && pir1.4) {
+		txreg = b;
+		return;
+	}
+	if((b & 0xF8) == 0xF8 && !tx_realtime) {
+		tx_realtime = b;
+		pie1.4 = 1;
+		return;
+	}
+	byte next_head = (tx_head + 1)&SZ_TXBUFFER_MASK;
+	if(next_head != tx_tail) {
+		tx_buffer[tx_head] = b;
+		tx_head = next_head;
+		pie1.4 = 1; 
+	}
+	else {
+		++rx_stats[STAT_TX_LOST];
+	}
+}
+
+////////////////////////////////////////////////////////////
+// CHECK WHETHER A CHANNEL MESSAGE SHOULD BE PASSED THRU
+// Called from the interrupt service routine only
+static byte thru_accept(byte status)
+{
+	if(g_global.thru == THRU_UNUSED) {
+		return !g_midi_filter[status & 0x0F];
+	}
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+// SOFT MIDI THRU
+// Called from the interrupt service routine with each byte
+// as it is received, so bytes are forwarded with at most a 
+// byte or two of delay. Running status is restarted on the 
+// output whenever the input stream and output stream differ
+// (because messages were stripped or a report was sent)
+static void thru_byte(byte b)
+{
+	// REALTIME MESSAGE
+	if((b & 0xF8) == 0xF8) {
+		tx_put(b);
+		return;
+	}
+	if(g_global.thru == THRU_REALTIME) {
+		return;
+	}
+	
+	// STATUS BYTE
+	if(b & 0x80) {
+		// end a sysex block we were passing
+		if(b == MIDI_SYSEX_END && thru_pass && thru_len == THRU_SYSEX) {
+			tx_put(b);
+			thru_pass = 0;
+		}
+		// CHANNEL MESSAGE
+		else if(b < 0xF0) {
+			thru_in_status = b;
+			switch(b & 0xF0) {
+			case 0xC0: 
+			case 0xD0: 
+				thru_len = 1; 
+				break;
+			default:
+				thru_len = 2;
+				break;
+			}
+			thru_pass = thru_accept(b);
+			if(thru_pass && thru_out_status != b) {
+				tx_put(b);
+				thru_out_status = b;
+			}
+		}
+		// SYSTEM COMMON MESSAGE (cancels running status)
+		else {
+			thru_in_status = 0;
+			switch(b) {
+			case MIDI_SYSEX_BEGIN:		thru_len = THRU_SYSEX; break;
+			case MIDI_MTC_QTR_FRAME:	thru_len = 1; break;
+			case MIDI_SONG_SELECT:		thru_len = 1; break;
+			case MIDI_SPP:				thru_len = 2; break;
+			default:					thru_len = 0; break;
+			}
+			thru_pass = 1;
+			tx_put(b);
+			thru_out_status = 0;
+		}
+		thru_count = 0;
+	}
+	// DATA BYTE
+	else {
+		if(thru_len != THRU_SYSEX && thru_count >= thru_len) {
+			// new message using running status
+			if(!thru_in_status) {
+				thru_busy = 0;
+				return;	// stray data byte
+			}
+			thru_pass = thru_accept(thru_in_status);
+			thru_count = 0;
+		}
+		if(thru_pass) {
+			if(thru_in_status && thru_out_status != thru_in_status) {
+				tx_put(thru_in_status);
+				thru_out_status = thru_in_status;
+			}
+			tx_put(b);
+		}
+		++thru_count;
+	}
+	thru_busy = thru_pass && (thru_len == THRU_SYSEX || thru_count < thru_len);
+}
+
+////////////////////////////////////////////////////////////
+// ADD A MESSAGE TO THE REALTIME QUEUE
+// Called from the interrupt service routine only
+static void rt_push(byte msg)
+{
+	byte next_head = (rt_head + 1)&SZ_RTQUEUE_MASK;
+	if(next_head != rt_tail) {
+		rt_queue[rt_head].msg = msg;
+		TIMER1_READ(rt_queue[rt_head].time);
+		rt_head = next_head;
+	}
+	else {
+		++rx_stats[STAT_RT_LOST];
+	}
+}
+
 ////////////////////////////////////////////////////////////
 // INTERRUPT SERVICE ROUTINE
 void interrupt( void )
@@ -113,24 +466,187 @@ void interrupt( void )
 	{
 		tmr0 = TIMER_0_INIT_SCALAR;
 		ms_tick = 1;
-//		++millis;
 		intcon.2 = 0;		
 	}		
 	
 	/////////////////////////////////////////////////////
 	// UART RECEIVE
+	// MIDI is parsed here so that the main loop only ever
+	// sees complete messages
 	if(pir1.5)
 	{	
 		byte b = rcreg;
-		byte next_head = (rx_head + 1)&SZ_RXBUFFER_MASK;
-		if(next_head != rx_tail) {
-			rx_buffer[rx_head] = b;
-			rx_head = next_head;
+		if(g_global.thru != THRU_OFF) {
+			thru_byte(b);
+		}
+		
+		// REALTIME MESSAGE (can appear anywhere, even between
+		// the data bytes of another message). Clock messages go
+		// into their own queue, stamped with their arrival time
+		if((b & 0xF8) == 0xF8) 
+		{
+			switch(b)
+			{
+			case MIDI_SYNCH_TICK:
+			case MIDI_SYNCH_START:
+			case MIDI_SYNCH_CONTINUE:
+			case MIDI_SYNCH_STOP:
+				rt_push(b);
+				break;
+			}
+		}
+		// STATUS BYTE
+		else if(b & 0x80)
+		{
+			// any status byte ends a sysex block
+			if(rx_sysex == SYSEX_PARAMH) {
+				rx_push((b == MIDI_SYSEX_END)? MIDI_SYSEX_END : RX_SYSEX_ABORT, 0, 0);
+			}
+			rx_sysex = SYSEX_NONE;
+			rx_param = 0;
+			switch(b)
+			{
+			// START OF SYSEX
+			case MIDI_SYSEX_BEGIN:
+				rx_sysex = SYSEX_ID0;
+				rx_status = 0;
+				break;
+			// SYSTEM COMMON MESSAGES WITH PARAMETERS
+			case MIDI_MTC_QTR_FRAME:	// 1 param byte follows
+			case MIDI_SONG_SELECT:		// 1 param byte follows			
+			case MIDI_SPP:				// 2 param bytes follow
+				rx_status = b;
+				rx_num_params = (b == MIDI_SPP)? 2:1;
+				break;
+			default:
+				// CHANNEL MESSAGE
+				if(b < 0xF0) {
+					rx_status = b;
+					switch(b & 0xF0) 
+					{
+					case 0xC0: //  Patch change  1  instrument #   
+					case 0xD0: //  Channel Pressure  1  pressure  
+						rx_num_params = 1;
+						break;
+					default:
+						rx_num_params = 2;
+						break;
+					}
+				}
+				break;
+			}
+		}
+		// DATA BYTE
+		else 
+		{
+			switch(rx_sysex) // are we inside a sysex block?
+			{
+			// SYSEX MANUFACTURER ID
+			case SYSEX_ID0: rx_sysex = (b == MY_SYSEX_ID0)? SYSEX_ID1 : SYSEX_IGNORE; break;
+			case SYSEX_ID1: rx_sysex = (b == MY_SYSEX_ID1)? SYSEX_ID2 : SYSEX_IGNORE; break;
+			case SYSEX_ID2: 
+				if(b == MY_SYSEX_ID2) {
+					rx_sysex = SYSEX_PARAMH;
+					rx_push(MIDI_SYSEX_BEGIN, 0, 0);
+				}
+				else if(b == MY_SYSEX_ID2_ADDR) {
+					rx_sysex = SYSEX_DEVICE;
+				}
+				else {
+					rx_sysex = SYSEX_IGNORE;
+				}
+				break;
+			// DEVICE ID (payloads for other units are skipped here)
+			case SYSEX_DEVICE:
+				if(b == g_global.device_id || b == SYSEX_DEVICE_ALL) {
+					rx_sysex = SYSEX_PARAMH;
+					rx_push(MIDI_SYSEX_BEGIN, 0, 0);
+				}
+				else {
+					rx_sysex = SYSEX_IGNORE;
+				}
+				break;
+			// PAYLOAD OF A SYSEX FOR US
+			case SYSEX_PARAMH: 
+				rx_push(RX_SYSEX_DATA, b, 0); 
+				break;
+			case SYSEX_IGNORE: 
+				break;
+			// MIDI DATA
+			default:
+				if(rx_status)
+				{
+					// gathering parameters
+					rx_params[rx_param++] = b;
+					if(rx_param >= rx_num_params)
+					{
+						// we have a complete message.. is it one we care about?
+						// (the input filter says which message types are used 
+						// on each MIDI channel by the current patch)
+						rx_param = 0;
+						byte filter = g_midi_filter[rx_status & 0x0F];
+						switch(rx_status & 0xF0)
+						{
+						case 0x80: // note off
+						case 0x90: // note on
+							filter &= MIDI_FILTER_NOTE;
+							break;
+						case 0xE0: // pitch bend
+							filter &= MIDI_FILTER_BEND;
+							break;
+						case 0xB0: // cc
+							switch(rx_params[0]) {
+							case MIDI_CC_NRPN_HI: // NRPN config is accepted on any channel
+							case MIDI_CC_NRPN_LO:
+							case MIDI_CC_DATA_HI:
+							case MIDI_CC_DATA_LO:
+								filter = 1;
+								break;
+							default:
+								filter &= MIDI_FILTER_CC;
+								break;
+							}
+							break;
+						case 0xD0: // channel pressure
+							filter &= MIDI_FILTER_TOUCH;
+							break;
+						case 0xA0: // poly pressure
+							filter &= MIDI_FILTER_POLY_TOUCH;
+							break;
+						default:
+							filter = 0;
+							break;
+						}
+						if(filter) {
+							rx_push(rx_status, rx_params[0], rx_params[1]); 
+						}
+					}
+				}
+				break;
+			}
 		}
 		LED_1_PULSE(LED_PULSE_MIDI_IN);
 		pir1.5 = 0;
 	}
 
+	/////////////////////////////////////////////////////
+	// UART TRANSMIT
+	if(pie1.4 && pir1.4)
+	{
+		if(tx_realtime) {
+			txreg = tx_realtime;
+			tx_realtime = 0;
+		}
+		else if(tx_head != tx_tail) {
+			// send next byte (this clears the interrupt flag)
+			txreg = tx_buffer[tx_tail];
+			tx_tail = (tx_tail + 1)&SZ_TXBUFFER_MASK;
+		}
+		else {
+			pie1.4 = 0; // nothing more to send - disable the interrupt
+		}
+	}
+
 	/////////////////////////////////////////////////////
 	// I2C INTERRUPT
 	if(pir1.3) 
@@ -145,15 +661,6 @@ void interrupt( void )
 			ssp1con2.2 = 1; // send stop condition
 		}
 		else {			
-			// check if there is any synchronised gate data (This mechanism is designed to trigger
-			// a gate associated with a note only after the CV has been output to the DAC, so the 
-			// gate does not open before the note CV sweeps to the new value)
-			if(g_sync_sr_data_pending) {
-				g_sr_data |= g_sync_sr_data;	// set the new gates
-				g_sync_sr_data = 0;				// no syncronised data pending now..
-				g_sync_sr_data_pending = 0;		
-				g_sr_data_pending = 1;			// but we do need to load the new info to shift regs
-			}			
 			pie1.3 = 0; // we're done - disable the I2C interrupt
 		}
 	}
@@ -175,8 +682,13 @@ static void i2c_init() {
 	ssp1con1.1 = 0; // }
 	ssp1con1.0 = 0; // } I2C Master with clock = Fosc/(4(SSPxADD+1))
 	
+#ifdef I2C_FAST_MODE
+	ssp1stat.7 = 0;	// slew rate control enabled
+	ssp1add = 9;	// 400kHz baud rate
+#else
 	ssp1stat.7 = 1;	// slew rate disabled	
-	ssp1add = 19;	// 100kHz baud rate
+	ssp1add = 19;	// 200kHz baud rate
+#endif
 }
 
 ////////////////////////////////////////////////////////////
@@ -227,16 +739,26 @@ void timer_init() {
 	option_reg.0 = 1; // }
 	intcon.5 = 1; 	  // enabled timer 0 interrrupt
 	intcon.2 = 0;     // clear interrupt fired flag
+	
+	// Configure timer 1 (free running timestamp counter)
+	// 	timer 1 runs at 4MHz
+	// 	prescaled 1/8 = 500kHz
+	// 	2us per count, rolls over every 131ms
+	t1con.7 = 0; // }
+	t1con.6 = 0; // } timer 1 driven from instruction cycle clock
+	t1con.5 = 1; // }
+	t1con.4 = 1; // } 1/8 prescaler
+	t1con.3 = 0; // oscillator circuit off
+	t1con.0 = 1; // timer 1 on
 }
 
 ////////////////////////////////////////////////////////////
 // INITIALISE SERIAL PORT FOR MIDI
 void uart_init()
 {
-	pir1.1 = 0;		//TXIF 		
 	pir1.5 = 0;		//RCIF
 	
-	pie1.1 = 0;		//TXIE 		no interrupts
+	pie1.4 = 0;		//TXIE 		enabled when there is data to send
 	pie1.5 = 1;		//RCIE 		enable
 	
 	baudcon.4 = 0;	// SCKP		synchronous bit polarity 
@@ -245,7 +767,7 @@ void uart_init()
 	baudcon.0 = 0;	// ABDEN	auto baud detect
 		
 	txsta.6 = 0;	// TX9		8 bit transmission
-	txsta.5 = 0;	// TXEN		transmit enable
+	txsta.5 = 1;	// TXEN		transmit enable
 	txsta.4 = 0;	// SYNC		async mode
 	txsta.3 = 0;	// SEDNB	break character
 	txsta.2 = 0;	// BRGH		high baudrate 
@@ -261,6 +783,196 @@ void uart_init()
 	
 }
 
+////////////////////////////////////////////////////////////
+// QUEUE A BYTE FOR MIDI OUTPUT
+// The caller must check there is space using uart_free()
+// Interrupts are held off since the receive interrupt also
+// adds THRU data to the buffer
+void uart_send(byte data)
+{
+	intcon.7 = 0; //GIE
+	tx_buffer[tx_head] = data;
+	tx_head = (tx_head + 1)&SZ_TXBUFFER_MASK;
+	pie1.4 = 1; // make sure the transmit interrupt is enabled
+	intcon.7 = 1;
+}
+
+////////////////////////////////////////////////////////////
+// GET FREE SPACE IN MIDI OUTPUT BUFFER
+byte uart_free()
+{
+	return (tx_tail - tx_head - 1)&SZ_TXBUFFER_MASK;
+}
+
+////////////////////////////////////////////////////////////
+// CLEAR LATENCY AND RECEIVE STATISTICS
+static void stats_clear()
+{
+	byte i;
+	for(byte lat_class=0; lat_class<LAT_MAX; ++lat_class) {
+		lat_range[lat_class][STAT_LAT_MIN] = 0xFFFF;
+		lat_range[lat_class][STAT_LAT_MAX] = 0;
+		for(i=0; i<LAT_HIST_BUCKETS; ++i) {
+			lat_hist[lat_class][i] = 0;
+		}
+	}
+	for(i=0; i<STAT_RX_FIELDS; ++i) {
+		rx_stats[i] = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// NOTE WHICH OUTPUTS HAVE NOTHING PENDING
+// Called before a message is dispatched, so that data left 
+// pending by anything else (e.g. LFOs, envelopes or glides on 
+// the ms tick) is not charged to the message
+static void latency_mark()
+{
+	lat_idle = 0;
+	if(!g_cv_dac_pending) {
+		lat_idle |= LAT_IDLE_DAC;
+	}
+	if(!(g_sr_data_pending || g_sync_sr_data_pending || g_sr_retrigs)) {
+		lat_idle |= LAT_IDLE_SR;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// NOTE THE OUTPUTS WAITING ON A MESSAGE
+// Called after a message has been dispatched. If the message
+// has left new data pending for the DAC or the gates then its
+// arrival time is kept until that data is written out. Only 
+// the oldest message waiting on each output is timed, and only
+// outputs that had nothing pending before the dispatch count
+static void latency_track(byte lat_class, unsigned int time)
+{
+	if((lat_idle & LAT_IDLE_DAC) && g_cv_dac_pending && lat_dac_class == LAT_NONE) {
+		lat_dac_class = lat_class;
+		lat_dac_time = time;
+	}
+	if((lat_idle & LAT_IDLE_SR) && (g_sr_data_pending || g_sync_sr_data_pending || g_sr_retrigs) && lat_sr_class == LAT_NONE) {
+		lat_sr_class = lat_class;
+		lat_sr_time = time;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// RECORD THE LATENCY OF A MESSAGE THAT HAS REACHED AN OUTPUT
+static void latency_record(byte lat_class, unsigned int time)
+{
+	unsigned int now;
+	TIMER1_READ(now);
+	unsigned int latency = now - time;
+	
+	unsigned int *prange = lat_range[lat_class];
+	if(latency < prange[STAT_LAT_MIN]) {
+		prange[STAT_LAT_MIN] = latency;
+	}
+	if(latency > prange[STAT_LAT_MAX]) {
+		prange[STAT_LAT_MAX] = latency;
+	}
+	
+	// find the histogram bucket
+	byte bucket = 0;
+	latency >>= 6;
+	while(latency && bucket < LAT_HIST_BUCKETS - 1) {
+		latency >>= 1;
+		++bucket;
+	}
+	byte *phist = lat_hist[lat_class];
+	if(phist[bucket] == 0xFF) {
+		for(byte i=0; i<LAT_HIST_BUCKETS; ++i) {
+			phist[i] >>= 1;
+		}
+	}
+	++phist[bucket];
+}
+
+////////////////////////////////////////////////////////////
+// GET A VALUE FOR THE STATISTICS REPORT
+// param is (message class * 16) + field for latency statistics, 
+// followed by the receive statistics at (LAT_MAX * 16) + field.
+// Returns zero if there is no such statistic
+static byte stats_value(byte param, unsigned int *value)
+{
+	byte lat_class = param>>4;
+	byte field = param & 0x0F;
+	if(lat_class == LAT_MAX && field < STAT_RX_FIELDS) {
+		*value = rx_stats[field];
+		return 1;
+	}
+	if(lat_class >= LAT_MAX || field >= STAT_LAT_FIELDS) {
+		return 0;
+	}
+	if(field < STAT_LAT_HIST) {
+		*value = lat_range[lat_class][field];
+	}
+	else {
+		*value = lat_hist[lat_class][field - STAT_LAT_HIST];
+	}
+	return 1;
+}
+
+////////////////////////////////////////////////////////////
+// HANDLE A REQUEST FOR THE STATISTICS REPORT
+// clear is nonzero to reset the statistics instead
+void stats_request(byte clear)
+{
+	if(clear) {
+		stats_clear();
+	}
+	else if(report_param == REPORT_IDLE) {
+		report_param = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// SEND THE NEXT PART OF THE STATISTICS REPORT
+// The report is a series of sysex blocks addressed with our 
+// device id, each holding one of the 4 byte parameter groups 
+// used in a patch, with NRPNH_STATS as the high byte of the 
+// parameter number. Values are limited to 14 bits. A block is 
+// only sent when the transmit buffer is empty and THRU is 
+// between messages, so THRU is never held up by more than one
+// block and nothing needs to be dropped to make way for it
+static void stats_run()
+{
+	unsigned int value;
+	if(report_param == REPORT_IDLE || tx_head != tx_tail) {
+		return;
+	}
+	while(report_param < 0x80) {
+		byte param = report_param++;
+		if(stats_value(param, &value)) {
+			if(value > 0x3FFF) {
+				value = 0x3FFF;
+			}
+			// interrupts are held off so the block cannot be
+			// split by THRU data
+			intcon.7 = 0; //GIE
+			if(thru_busy) {
+				--report_param;
+			}
+			else {
+				tx_put(MIDI_SYSEX_BEGIN);
+				tx_put(MY_SYSEX_ID0);
+				tx_put(MY_SYSEX_ID1);
+				tx_put(MY_SYSEX_ID2_ADDR);
+				tx_put(g_global.device_id);
+				tx_put(NRPNH_STATS);
+				tx_put(param);
+				tx_put(value>>7);
+				tx_put(value & 0x7F);
+				tx_put(MIDI_SYSEX_END);
+				thru_out_status = 0; // running status restarts after sysex
+			}
+			intcon.7 = 1;
+			return;
+		}
+	}
+	report_param = REPORT_IDLE;
+}
+
 ////////////////////////////////////////////////////////////
 // LOAD GATE SHIFT REGISTER
 void sr_write(unsigned int nmask) {
@@ -279,6 +991,73 @@ void sr_write(unsigned int nmask) {
 	P_SRLAT = 1;
 }
 
+////////////////////////////////////////////////////////////
+// REBUILD ROUTING TABLES AFTER A CONFIG CHANGE
+// This is deferred until a message needs to be dispatched or 
+// any sysex block has ended, so a patch arriving by sysex only 
+// rebuilds the tables once. The input filter is built from 
+// the routing tables of each module
+static void route_update()
+{
+	if(route_pending) {
+		route_pending = 0;
+		stack_route();
+		cv_route();
+		gate_route();
+		for(byte chan=0; chan<16; ++chan) {
+			g_midi_filter[chan] = stack_filter(chan) | cv_filter(chan) | gate_filter(chan);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// START AN LED FEEDBACK SEQUENCE
+// The sequence is then played by led_seq_run on the ms tick 
+// so that MIDI input and gate timers keep running
+static void led_seq_start(byte seq)
+{
+	led_seq = seq;
+	if(seq == LED_SEQ_COMMIT) {
+		led_seq_count = 4;		// 4 x 250ms
+		led_seq_timer = 250;
+	}
+	else {
+		led_seq_count = 20;		// 10 x (100ms on, 100ms off)
+		led_seq_timer = 100;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// PLAY THE LED FEEDBACK SEQUENCE
+// Called once per ms. Returns nonzero while a sequence is 
+// playing, in which case it owns both LEDs
+static byte led_seq_run()
+{
+	if(!led_seq_count) {
+		return 0;
+	}
+	if(!--led_seq_timer) {
+		--led_seq_count;
+		led_seq_timer = (led_seq == LED_SEQ_COMMIT)? 250 : 100;
+	}
+	if(!led_seq_count) {
+		// finished; drop any pulses started while we were playing
+		g_led_1_timeout = 0;
+		g_led_2_timeout = 0;
+		P_LED1 = 0;
+		P_LED2 = 0;
+	}
+	else if(led_seq == LED_SEQ_COMMIT) {
+		P_LED1 = 1;
+		P_LED2 = 1;
+	}
+	else {
+		P_LED1 = 0;
+		P_LED2 = !(led_seq_count & 1);
+	}
+	return 1;
+}
+
 ////////////////////////////////////////////////////////////
 // RESET STATES
 void all_reset()
@@ -288,12 +1067,70 @@ void all_reset()
 	stack_reset();
 }
 
+////////////////////////////////////////////////////////////
+// CHECK WHETHER A CONTROLLER MESSAGE HAS BEEN SUPERSEDED
+// A CC, pitch bend, channel or poly pressure message can be 
+// skipped if a newer message for the same controller (or note)
+// on the same channel is already waiting in the queue, since the newer 
+// value would immediately replace it anyway. The search stops 
+// at a note on or off on the same channel, so a note is always 
+// played with the values that came before it. Nothing is ever
+// reordered, so notes and clock are not affected
+static byte midi_superseded(byte status)
+{
+	switch(status & 0xF0)
+	{
+	case 0xB0: 
+		switch(midi_params[0]) {
+		case MIDI_CC_NRPN_HI:	// NRPN values must all be seen
+		case MIDI_CC_NRPN_LO:
+		case MIDI_CC_DATA_HI:
+		case MIDI_CC_DATA_LO:
+			return 0;
+		}
+		// channel mode messages are not continuous controllers, and
+		// a CC driving a gate must not miss a threshold crossing
+		if(midi_params[0] >= 120 || gate_uses_cc(midi_params[0])) {
+			return 0;
+		}
+		// the MSB and LSB of a 14-bit CC must stay paired
+		if(cv_cc_paired(midi_params[0])) {
+			return 0;
+		}
+		break;
+	case 0xA0: // poly pressure
+	case 0xD0: // channel pressure
+	case 0xE0: // pitch bend
+		break;
+	default:
+		return 0;
+	}
+	
+	// look for a newer message with the same status (and same CC or note number)
+	byte head = rx_head;
+	for(byte i = rx_tail; i != head; i = RX_NEXT(i)) {
+		byte queued = rx_queue[i].status;
+		if((queued & 0xE0) == 0x80 && (queued & 0x0F) == (status & 0x0F)) {
+			return 0;	// note on or off (0x8n or 0x9n) on the same channel
+		}
+		if(queued == status) {
+			if(((status & 0xF0) != 0xB0 && (status & 0xF0) != 0xA0) || rx_queue[i].params[0] == midi_params[0]) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 // GET MESSAGES FROM MIDI INPUT
+// Messages arrive already parsed by the receive interrupt, 
+// so all that is left to do here is to handle sysex data 
+// and return the next message for dispatch
 byte midi_in()
 {
 	// loop until there is no more data or
-	// we receive a full message
+	// we receive a message for dispatch
 	for(;;)
 	{
 		// usart buffer overrun error?
@@ -301,150 +1138,105 @@ byte midi_in()
 		{
 			rcsta.4 = 0;
 			rcsta.4 = 1;
+			++rx_stats[STAT_RX_OVERRUNS];
 		}
 		
-		// check for empty receive buffer
+		// check for empty receive queue
 		if(rx_head == rx_tail)
 			return 0;
 		
-		// read the character out of buffer
-		byte ch = rx_buffer[rx_tail];
-		++rx_tail;
-		rx_tail&=SZ_RXBUFFER_MASK;
+		// read the message out of the queue
+		byte status = rx_queue[rx_tail].status;
+		midi_params[0] = rx_queue[rx_tail].params[0];
+		midi_params[1] = rx_queue[rx_tail].params[1];
+		midi_time = rx_queue[rx_tail].time;
+		rx_tail = RX_NEXT(rx_tail);
 
-		// SYSTEM MESSAGE
-		if((ch & 0xf0) == 0xf0)
+		switch(status)
 		{
-			switch(ch)
+		// START OF A SYSEX BLOCK FOR US
+		case MIDI_SYSEX_BEGIN:
+			sysex_state = SYSEX_PARAMH;
+			sysex_changes = 0;
+			break;
+		// SYSEX BLOCK CUT SHORT BY ANOTHER MESSAGE
+		case RX_SYSEX_ABORT:
+			sysex_state = SYSEX_NONE; 
+			break;
+		// CONFIG PARAM DELIVERED BY SYSEX
+		case RX_SYSEX_DATA:
+			switch(sysex_state) 
 			{
-			// RELEVANT REALTIME MESSAGE 
-			case MIDI_SYNCH_TICK:
-			case MIDI_SYNCH_START:
-			case MIDI_SYNCH_CONTINUE:
-			case MIDI_SYNCH_STOP:
-				return ch;		
-			// SYSTEM COMMON MESSAGES WITH PARAMETERS
-			case MIDI_MTC_QTR_FRAME:	// 1 param byte follows
-			case MIDI_SONG_SELECT:		// 1 param byte follows			
-			case MIDI_SPP:				// 2 param bytes follow
-				midi_param = 0;
-				midi_status = ch; 
-				midi_num_params = (ch==MIDI_SPP)? 2:1;
-				break;
-			// START OF SYSEX	
-			case MIDI_SYSEX_BEGIN:
-				sysex_state = SYSEX_ID0; 
-				break;
-			// END OF SYSEX	
-			case MIDI_SYSEX_END:
-				switch(sysex_state) {
-				case SYSEX_IGNORE: // we're ignoring a syex block
-				case SYSEX_NONE: // we weren't even in sysex mode!					
-					break;			
-				case SYSEX_PARAMH:	// the state we'd expect to end in
-					P_LED1 = 1; 
-					P_LED2 = 1; 
-					delay_ms(250); 
-					delay_ms(250); 
-					delay_ms(250); 
-					delay_ms(250); 
-					P_LED1 = 0; 
-					P_LED2 = 0; 
-					storage_write_patch();	// store to EEPROM 
-					all_reset();
-					break;
-				default:	// any other state would imply bad sysex data
-					P_LED1 = 0; 
-					for(char i=0; i<10; ++i) {
-						P_LED2 = 1; 
-						delay_ms(100);
-						P_LED2 = 0; 
-						delay_ms(100);
-					}
-					all_reset();
+			case SYSEX_PARAMH: nrpn_hi = midi_params[0]; ++sysex_state; break;
+			case SYSEX_PARAML: nrpn_lo = midi_params[0]; ++sysex_state;break;
+			case SYSEX_VALUEH: nrpn_value_hi = midi_params[0]; ++sysex_state;break;
+			case SYSEX_VALUEL: sysex_changes |= nrpn(nrpn_hi, nrpn_lo, nrpn_value_hi, midi_params[0]); sysex_state = SYSEX_PARAMH; break;
+			}
+			break;
+		// END OF SYSEX	
+		case MIDI_SYSEX_END:
+			switch(sysex_state) {
+			case SYSEX_NONE: // we weren't even in sysex mode!					
+				break;			
+			case SYSEX_PARAMH:	// the state we'd expect to end in
+				if(!sysex_changes) { // e.g. a request for statistics
 					break;
 				}
-				sysex_state = SYSEX_NONE; 
+				led_seq_start(LED_SEQ_COMMIT);
+				storage_begin_write();	// store to EEPROM in the background
+				all_reset();
+				break;
+			default:	// any other state would imply bad sysex data
+				led_seq_start(LED_SEQ_ERROR);
+				all_reset();
 				break;
 			}
-			// Ignoring....			
-			//  0xF4	RESERVED
-			//  0xF5	RESERVED
-			//  0xF6	TUNE REQUEST
-			//	0xF9	RESERVED
-			//	0xFD	RESERVED
-			//	0xFE	ACTIVE SENSING
-			//	0xFF	RESET
-		}    
-		// STATUS BYTE
-		else if(!!(ch & 0x80))
-		{
-			// a status byte cancels sysex state
-			sysex_state = SYSEX_NONE;
-		
-			midi_param = 0;
-			midi_status = ch; 
-			switch(ch & 0xF0)
-			{
-			case 0xC0: //  Patch change  1  instrument #   
-			case 0xD0: //  Channel Pressure  1  pressure  
-				midi_num_params = 1;
-				break;    
-			case 0xA0: //  Polyphonic aftertouch  2  key  touch  
-			case 0x80: //  Note-off  2  key  velocity  
-			case 0x90: //  Note-on  2  key  veolcity  
-			case 0xB0: //  Continuous controller  2  controller #  controller value  
-			case 0xE0: //  Pitch bend  2  lsb (7 bits)  msb (7 bits)  
-			default:
-				midi_num_params = 2;
-				break;        
-			}
-		}    
-		else 
-		{
-			switch(sysex_state) // are we inside a sysex block?
-			{
-			// SYSEX MANUFACTURER ID
-			case SYSEX_ID0: sysex_state = (ch == MY_SYSEX_ID0)? SYSEX_ID1 : SYSEX_IGNORE; break;
-			case SYSEX_ID1: sysex_state = (ch == MY_SYSEX_ID1)? SYSEX_ID2 : SYSEX_IGNORE; break;
-			case SYSEX_ID2: sysex_state = (ch == MY_SYSEX_ID2)? SYSEX_PARAMH : SYSEX_IGNORE; break;
-			// CONFIG PARAM DELIVERED BY SYSEX
-			case SYSEX_PARAMH: nrpn_hi = ch; ++sysex_state; break;
-			case SYSEX_PARAML: nrpn_lo = ch; ++sysex_state;break;
-			case SYSEX_VALUEH: nrpn_value_hi = ch; ++sysex_state;break;
-			case SYSEX_VALUEL: nrpn(nrpn_hi, nrpn_lo, nrpn_value_hi, ch); sysex_state = SYSEX_PARAMH; break;
-			case SYSEX_IGNORE: break;			
-			// MIDI DATA
-			case SYSEX_NONE: 
-				if(midi_status)
-				{
-					// gathering parameters
-					midi_params[midi_param++] = ch;
-					if(midi_param >= midi_num_params)
-					{
-						// we have a complete message.. is it one we care about?
-						midi_param = 0;
-						switch(midi_status&0xF0)
-						{
-						case 0x80: // note off
-						case 0x90: // note on
-						case 0xE0: // pitch bend
-						case 0xB0: // cc
-						case 0xD0: // channel pressure
-							return midi_status; 
-						}
-					}
-				}
+			sysex_state = SYSEX_NONE; 
+			break;
+		// CHANNEL MESSAGE
+		default:
+			route_update();
+			if(!midi_superseded(status)) {
+				return status;
 			}
+			++rx_stats[STAT_RX_COALESCED];
+			break;
 		}
 	}
 	// no message ready yet
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+// HANDLE A MIDI REALTIME MESSAGE
+static void midi_clock(byte msg) 
+{
+	switch(msg) {
+	case MIDI_SYNCH_TICK:
+		if(!midi_ticks) {
+			LED_2_PULSE(LED_PULSE_MIDI_BEAT);				
+		}
+		cv_midi_tick(midi_clock_time);
+		if(++midi_ticks>=24) {
+			midi_ticks = 0;
+		}
+		gate_midi_clock(msg);
+		break;
+	case MIDI_SYNCH_START:
+		midi_ticks = 0;
+		cv_midi_start();
+		// fall thru
+	case MIDI_SYNCH_CONTINUE:
+	case MIDI_SYNCH_STOP:
+		gate_midi_clock(msg);
+		break;	
+	}
+}
+
 ////////////////////////////////////////////////////////////
 // CONFIGURATION BY NRPN
-void nrpn(byte param_hi, byte param_lo, byte value_hi, byte value_lo) {
+// return nonzero if any change was made
+byte nrpn(byte param_hi, byte param_lo, byte value_hi, byte value_lo) {
 	byte result = 0;
 	switch(param_hi) {
 		case NRPNH_GLOBAL:
@@ -478,8 +1270,10 @@ void nrpn(byte param_hi, byte param_lo, byte value_hi, byte value_lo) {
 			break;
 	}
 	if(result) {
+		route_pending = 1;
 		LED_2_PULSE(LED_PULSE_PARAM);						
 	}
+	return result;
 }
 
 ////////////////////////////////////////////////////////////
@@ -501,6 +1295,7 @@ void main()
 	intcon.6 = 1; //PEIE
 
 	g_cv_dac_pending = 0;
+	stats_clear();
 	nrpn_hi = 0;
 	nrpn_lo = 0;
 	nrpn_value_hi = 0;
@@ -526,27 +1321,37 @@ void main()
 
 	// App loop
 	int bend;
-	long tick_time = 0; // milliseconds between ticks x 256
 	for(;;)
 	{	
 		// once per millisecond tick event
 		if(ms_tick) {
 			ms_tick = 0;
 			
-			// update the gates...
+			// update the gates, bends and glides...
+			stack_run();
 			gate_run();
+			cv_run();
 			
-			// update LED1
-			if(g_led_1_timeout) {
-				if(!--g_led_1_timeout) {
-					P_LED1 = 0;
-				}
+			// time the DAC refresh period
+			if(dac_timer) {
+				--dac_timer;
+			}
+			if(g_cv_dac_hold) {
+				--g_cv_dac_hold;
 			}
 			
-			// update LED2
-			if(g_led_2_timeout) {
-				if(!--g_led_2_timeout) {
-					P_LED2 = 0;
+			// play any sysex feedback sequence, otherwise
+			// update LED1 and LED2 pulses
+			if(!led_seq_run()) {
+				if(g_led_1_timeout) {
+					if(!--g_led_1_timeout) {
+						P_LED1 = 0;
+					}
+				}
+				if(g_led_2_timeout) {
+					if(!--g_led_2_timeout) {
+						P_LED2 = 0;
+					}
 				}
 			}
 			
@@ -567,35 +1372,26 @@ void main()
 			}
 		}
 		
+		// dispatch any waiting realtime messages ahead of anything
+		// else so that clock latency does not depend on MIDI traffic
+		while(rt_head != rt_tail) {
+			byte rt_msg = rt_queue[rt_tail].msg;
+			midi_clock_time = rt_queue[rt_tail].time;
+			rt_tail = (rt_tail + 1)&SZ_RTQUEUE_MASK;
+			latency_mark();
+			midi_clock(rt_msg);
+			latency_track(LAT_CLOCK, midi_clock_time);
+		}
+		
 		// poll for incoming MIDI data
 		byte msg = midi_in();		
+		
+		// apply any config change to the routing tables and input filter
+		if(sysex_state == SYSEX_NONE) {
+			route_update();
+		}
+		latency_mark();
 		switch(msg & 0xF0) {
-		// REALTIME MESSAGE
-		case 0xF0:
-			switch(msg) {
-			case MIDI_SYNCH_TICK:
-				if(!midi_ticks) {
-					LED_2_PULSE(LED_PULSE_MIDI_BEAT);				
-//					if(millis>0) {		
-//						cv_midi_bpm(((long)256*60000)/millis);					
-//						millis = 0;
-//					}
-				}
-				if(++midi_ticks>=24) {
-					midi_ticks = 0;
-				}
-				gate_midi_clock(msg);
-				break;
-			case MIDI_SYNCH_START:
-				midi_ticks = 0;
-				// fall thru
-			case MIDI_SYNCH_CONTINUE:
-			case MIDI_SYNCH_STOP:
-				gate_midi_clock(msg);
-				break;	
-			}
-			break;
-				
 		// MIDI NOTE OFF
 		case 0x80:
 			stack_midi_note(msg&0x0F, midi_params[0], 0);
@@ -621,9 +1417,11 @@ void main()
 					break;
 				case MIDI_CC_DATA_HI:
 					nrpn_value_hi = midi_params[1];
+					cv_midi_nrpn(msg&0x0F, nrpn_hi, nrpn_lo, midi_params[1], 0);
 					break;
 				case MIDI_CC_DATA_LO:
 					nrpn(nrpn_hi, nrpn_lo, nrpn_value_hi, midi_params[1]);
+					cv_midi_nrpn(msg&0x0F, nrpn_hi, nrpn_lo, midi_params[1], 1);
 					break;
 				default:
 					cv_midi_cc(msg&0x0F, midi_params[0], midi_params[1]);
@@ -632,6 +1430,11 @@ void main()
 			}
 			break;
 
+		// POLY AFTERTOUCH
+		case 0xA0:
+			stack_midi_poly_touch(msg&0x0F, midi_params[0], midi_params[1]);
+			break;
+			
 		// AFTERTOUCH
 		case 0xD0: 
 			cv_midi_touch(msg&0x0F, midi_params[0]);
@@ -644,12 +1447,67 @@ void main()
 			cv_midi_bend(msg&0x0F, bend);
 			break;
 		}
+		
+		// carry the arrival time of the message through to the outputs
+		switch(msg & 0xF0) {
+		case 0x80:
+		case 0x90:
+			latency_track(LAT_NOTE, midi_time);
+			break;
+		case 0xA0:
+		case 0xB0:
+		case 0xD0:
+		case 0xE0:
+			latency_track(LAT_CC, midi_time);
+			break;
+		}
+		
+		// has a timed DAC transfer completed?
+		if(!pie1.3 && lat_i2c_class != LAT_NONE) {
+			latency_record(lat_i2c_class, lat_i2c_time);
+			lat_i2c_class = LAT_NONE;
+		}
+				
+		// once a DAC transfer has completed, set any gates that were 
+		// synchronised to it. This mechanism is designed to trigger
+		// a gate associated with a note only after the CV has been output 
+		// to the DAC, so the gate does not open before the note CV sweeps 
+		// to the new value
+		if(!pie1.3) {
+			if(g_sync_sr_armed) {
+				g_sr_data |= g_sync_sr_armed;
+				g_sync_sr_armed = 0;
+				g_sr_data_pending = 1;
+			}
+			if(!g_sync_sr_data) {
+				g_sync_sr_data_pending = 0;
+			}
+		}
 				
-		// check if there is any CV data to send out and no i2c transmit in progress
-		if(!pie1.3 && g_cv_dac_pending) {
-			cv_dac_prepare(); 
-			i2c_send_async();
+		// check if there is any CV data to send out and no i2c transmit in progress.
+		// CV data is committed to the DAC at a fixed refresh rate, so that a burst
+		// of MIDI cannot tie up the bus, except for note changes which go at once.
+		// Gates synchronised to this data are armed to fire when it completes.
+		// The refresh also waits briefly after a 14-bit MSB for its LSB.
+		// If the outputs have ended up back where they were there is no
+		// transfer, and any synchronised gates are released at once
+		if(!pie1.3 && g_cv_dac_pending && (g_cv_dac_urgent || (!dac_timer && !g_cv_dac_hold))) {
+			if(cv_dac_prepare()) {
+				g_sync_sr_armed = g_sync_sr_data;
+				g_sync_sr_data = 0;
+				i2c_send_async();
+				dac_timer = g_global.dac_period;
+				lat_i2c_class = lat_dac_class;
+				lat_i2c_time = lat_dac_time;
+			}
+			else if(g_sync_sr_data) {
+				g_sr_data |= g_sync_sr_data;
+				g_sync_sr_data = 0;
+				g_sr_data_pending = 1;
+			}
+			g_cv_dac_urgent = 0;
 			g_cv_dac_pending = 0; 
+			lat_dac_class = LAT_NONE;
 		}				
 		// check for retrigs.. if so all retrig bits will be sent low
 		if(g_sr_retrigs) {
@@ -661,6 +1519,18 @@ void main()
 			g_sr_data_pending = 0;
 			sr_write(0);
 		}			
+		// gates are written once there is nothing left waiting 
+		// on the end of a DAC transfer
+		if(lat_sr_class != LAT_NONE && !g_sync_sr_data_pending) {
+			latency_record(lat_sr_class, lat_sr_time);
+			lat_sr_class = LAT_NONE;
+		}
+		
+		// send statistics report if one has been requested
+		stats_run();
+		
+		// continue any patch write to EEPROM
+		storage_run();
 	}
 }
 
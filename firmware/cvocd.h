@@ -44,6 +44,7 @@
 #define NUM_NOTE_STACKS 4				// number of stacks supported
 #define NO_NOTE_OUT 0xFF 				// special "no note" value
 #define I2C_TX_BUF_SZ 12				// size of i2c transmit buffer
+//#define I2C_FAST_MODE					// run i2c at 400kHz rather than 200kHz
 
 // Defaults
 #define DEFAULT_GATE_NOTE 			60
@@ -59,6 +60,9 @@
 #define DEFAULT_CV_VEL_MAX_VOLTS 	5
 #define DEFAULT_CV_TOUCH_MAX_VOLTS 	5
 #define DEFAULT_CV_TEST_VOLTS 		5
+#define DEFAULT_CV_LFO_MAX_VOLTS 	5
+#define DEFAULT_CV_ENV_MAX_VOLTS 	5
+#define DEFAULT_DAC_PERIOD			2
 
 // Millisecond timings
 #define SHORT_BUTTON_PRESS 40
@@ -87,7 +91,9 @@
 // Sysex ID
 #define MY_SYSEX_ID0	0x00
 #define MY_SYSEX_ID1	0x7f
-#define MY_SYSEX_ID2	0x15 // CVOCD patch
+#define MY_SYSEX_ID2	0x15 // CVOCD patch (all units)
+#define MY_SYSEX_ID2_ADDR	0x16 // CVOCD patch, followed by device id
+#define SYSEX_DEVICE_ALL	0x7F // device id addressing all units
 
 // Utility macros to flash an LED
 #define LED_1_PULSE(ms) { P_LED1 = 1; g_led_1_timeout = ms; }
@@ -130,7 +136,8 @@ enum {
 	EV_NO_NOTE_D,
 	EV_NOTES_OFF,
 	EV_NOTE_ON,
-	EV_BEND
+	EV_BEND,
+	EV_TOUCH
 };
 
 // note stack note priority orders
@@ -154,10 +161,29 @@ enum {
 	TRANSPOSE_NONE			= 64	// transpose value for no transpose
 };
 
+// MIDI input filter bits (message types listened to on a channel)
+enum {
+	MIDI_FILTER_NOTE		= 0x01,
+	MIDI_FILTER_CC			= 0x02,
+	MIDI_FILTER_TOUCH		= 0x04,
+	MIDI_FILTER_BEND		= 0x08,
+	MIDI_FILTER_POLY_TOUCH	= 0x10
+};
+
+// Soft MIDI THRU modes
+enum {
+	THRU_OFF				= 0,	// MIDI output used only for reports
+	THRU_ALL				= 1,	// everything received is passed through
+	THRU_REALTIME			= 2,	// only realtime (clock) messages are passed
+	THRU_UNUSED				= 3		// channels used by this unit are stripped
+};
+
 // Parameter Number High Byte 
 enum {
 	// global settings
 	NRPNH_GLOBAL 	= 1,	
+	// statistics report
+	NRPNH_STATS		= 2,
 	// note stacks
 	NRPNH_STACK1 	= 11,
 	NRPNH_STACK2 	= 12,
@@ -199,9 +225,26 @@ enum {
 	NRPNL_TRANSPOSE		= 14,
 	NRPNL_VOLTS			= 15,
 	NRPNL_PITCH_SCHEME  = 16,
+	NRPNL_GLIDE_TIME	= 17,
+	NRPNL_THRU			= 18,
+	NRPNL_DEVICE_ID		= 19,
+	NRPNL_DAC_PERIOD	= 20,
+	NRPNL_NRPN_HI		= 21,
+	NRPNL_SLEW			= 22,
+	NRPNL_LFO_RATE		= 23,
+	NRPNL_LFO_SYNC		= 24,
+	NRPNL_ENV			= 25,
+	NRPNL_MOD1_SRC		= 26,
+	NRPNL_MOD1_DEPTH	= 27,
+	NRPNL_MOD2_SRC		= 28,
+	NRPNL_MOD2_DEPTH	= 29,
+	NRPNL_PB_SMOOTH		= 30,
+	NRPNL_CURVE			= 31,
+	NRPNL_CAL_POINT		= 97,
 	NRPNL_CAL_SCALE  	= 98,
 	NRPNL_CAL_OFS  		= 99,
-	NRPNL_SAVE			= 100
+	NRPNL_SAVE			= 100,
+	NRPNL_STATS			= 101
 };
 
 // Parameter Value High Byte
@@ -213,6 +256,8 @@ enum {
 	NRPVH_SRC_MIDICC_NEG	= 3,
 	NRPVH_SRC_MIDIBEND		= 4,
 	NRPVH_SRC_MIDITOUCH		= 5,
+	NRPVH_SRC_MIDINRPN		= 6,
+	NRPVH_SRC_LFO			= 7,
 
 	NRPVH_SRC_STACK1		= 11,
 	NRPVH_SRC_STACK2		= 12,
@@ -239,7 +284,30 @@ enum {
 
 	NRPVH_PITCH_VOCT		= 0,
 	NRPVH_PITCH_HZV			= 1,
-	NRPVH_PITCH_12VO		= 2
+	NRPVH_PITCH_12VO		= 2,
+
+	NRPVH_GLIDE_TIME		= 0,	// constant time glide
+	NRPVH_GLIDE_RATE		= 1,	// constant rate glide
+	NRPVH_GLIDE_TIME_LEGATO	= 2,	// constant time, only between held notes
+	NRPVH_GLIDE_RATE_LEGATO	= 3		// constant rate, only between held notes
+};
+
+// Modulation Source Value High Byte (value low byte is param)
+enum {
+	NRPVH_MOD_NONE			= 0,
+	NRPVH_MOD_CC			= 1,	// CC number
+	NRPVH_MOD_TOUCH			= 2,
+	NRPVH_MOD_BEND			= 3,
+	NRPVH_MOD_VEL			= 4,	// note stack 0-3
+	NRPVH_MOD_LFO			= 5		// CV output 0-3 in LFO mode
+};
+
+// Envelope Value High Byte
+enum {
+	NRPVH_ENV_ATTACK		= 0,
+	NRPVH_ENV_DECAY			= 1,
+	NRPVH_ENV_SUSTAIN		= 2,
+	NRPVH_ENV_RELEASE		= 3
 };
 
 // Parameter Value Low Byte
@@ -253,6 +321,29 @@ enum {
 
 	NRPVL_SRC_VEL				= 20,
 	//NRPVL_SRC_AFTERTOUCH		= 22
+	NRPVL_SRC_ENV				= 23,	// envelope
+	NRPVL_SRC_ENV_VEL			= 24,	// velocity scaled envelope
+	NRPVL_SRC_TOUCH1			= 25,	// poly aftertouch of note on output A-D
+	NRPVL_SRC_TOUCH2			= 26,
+	NRPVL_SRC_TOUCH3			= 27,
+	NRPVL_SRC_TOUCH4			= 28
+};
+
+// Response curves for 7-bit values (value low byte with NRPNL_CURVE)
+enum {
+	NRPVL_CURVE_LINEAR			= 0,
+	NRPVL_CURVE_EXP				= 1,
+	NRPVL_CURVE_LOG				= 2,
+	NRPVL_CURVE_S				= 3
+};
+
+// LFO waveforms (value low byte with NRPVH_SRC_LFO)
+enum {
+	NRPVL_LFO_SINE				= 0,
+	NRPVL_LFO_TRIANGLE			= 1,
+	NRPVL_LFO_SAW				= 2,
+	NRPVL_LFO_SQUARE			= 3,
+	NRPVL_LFO_SH				= 4		// sample and hold
 };
 
 //
@@ -264,6 +355,9 @@ typedef unsigned char byte;
 typedef struct {
 	byte chan;
 	byte gate_duration;
+	byte thru;			// THRU_xxx mode
+	byte device_id;		// id used to address this unit by sysex
+	byte dac_period;	// ms between DAC refreshes (0 = as fast as possible)
 } GLOBAL_CFG;
 
 // note stack config
@@ -274,6 +368,7 @@ typedef struct {
 	byte vel_min;		// minimum velocity threshold
 	byte bend_range;	// pitch bend range (+/- semitones)
 	byte priority;		// how notes are prioritised when assigned to outputs
+	byte bend_smooth;	// nonzero to interpolate between pitch bend messages
 } NOTE_STACK_CFG;
 
 // note stack state
@@ -281,7 +376,11 @@ typedef struct {
 	byte note[SZ_NOTE_STACK];	// the notes held in the stack
 	char count;					// number of held notes
 	byte out[4];				// the stack output notes
+	byte touch[4];				// poly aftertouch of the output notes
 	long bend;					// pitch bend
+	int bend_target;			// pitch bend being interpolated to
+	int bend_step;				// interpolation step per ms (0 if none)
+	byte bend_ms;				// ms since last pitch bend message
 	byte vel;					// note velocity	
 	byte index;					// index for note cycling
 } NOTE_STACK;
@@ -295,12 +394,15 @@ extern GLOBAL_CFG g_global;
 extern NOTE_STACK g_stack[NUM_NOTE_STACKS];
 extern NOTE_STACK_CFG g_stack_cfg[NUM_NOTE_STACKS];
 extern byte g_cv_dac_pending;
+extern byte g_cv_dac_urgent;
+extern byte g_cv_dac_hold;
 extern volatile byte g_i2c_tx_buf[I2C_TX_BUF_SZ];
 extern volatile byte g_i2c_tx_buf_index;
 extern volatile byte g_i2c_tx_buf_len;
 extern volatile unsigned int g_sr_data;
 extern volatile unsigned int g_sr_retrigs;
 extern volatile unsigned int g_sync_sr_data;
+extern volatile unsigned int g_sync_sr_armed;
 extern volatile unsigned int g_sync_sr_mask;
 extern volatile byte g_sync_sr_data_pending;
 extern volatile byte g_sr_data_pending;
@@ -313,7 +415,10 @@ extern volatile byte g_sr_data_pending;
 void i2c_send(byte data);
 void i2c_begin_write(byte address);
 void i2c_end();
-void nrpn(byte param_hi, byte param_lo, byte value_hi, byte value_lo);
+byte nrpn(byte param_hi, byte param_lo, byte value_hi, byte value_lo);
+void uart_send(byte data);
+byte uart_free();
+void stats_request(byte clear);
 
 // EXPORTED FUNCTIONS FROM GLOBAL MODULE
 void global_init();
@@ -323,20 +428,27 @@ byte *global_storage(int *len);
 // EXPORTED FUNCTIONS FROM NOTE STACK MODULE
 void stack_midi_note(byte chan, byte note, byte vel);
 void stack_midi_bend(byte chan, int bend);
+void stack_midi_poly_touch(byte chan, byte note, byte value);
 void stack_midi_aftertouch(byte chan, byte value);
 byte stack_nrpn(byte which_stack, byte param_lo, byte value_hi, byte value_lo);
 void stack_init();
 void stack_reset();
+void stack_route();
+void stack_run();
+byte stack_filter(byte chan);
 byte *stack_storage(int *len);
 
 // PUBLIC FUNCTIONS FROM GATES MODULE
 void gate_event(byte event, byte stack_id);
 void gate_midi_note(byte chan, byte note, byte vel);
 void gate_midi_cc(byte chan, byte cc, byte value);
+byte gate_uses_cc(byte cc);
 void gate_midi_clock(byte msg);
 void gate_run();
 void gate_init();
 void gate_reset();
+void gate_route();
+byte gate_filter(byte chan);
 void gate_trigger(byte which_gate, byte trigger_enabled);
 byte gate_nrpn(byte which_gate, byte param_lo, byte value_hi, byte value_lo);
 void gate_update();
@@ -346,18 +458,28 @@ byte *gate_storage(int *len);
 // PUBLIC FUNCTIONS FROM CV MODULE
 void cv_event(byte event, byte stack_id);
 void cv_midi_cc(byte chan, byte cc, byte value);
+void cv_midi_nrpn(byte chan, byte param_hi, byte param_lo, byte value, byte is_lsb);
+byte cv_cc_paired(byte cc);
 void cv_midi_touch(byte chan, byte value);
 void cv_midi_bend(byte chan, int bend);
-//void cv_midi_bpm(long value);
+void cv_midi_tick(unsigned int time);
+void cv_midi_start();
 void cv_init(); 
 void cv_reset();
+void cv_run();
+void cv_route();
+byte cv_filter(byte chan);
 byte cv_nrpn(byte which_cv, byte param_lo, byte value_hi, byte value_lo);
-void cv_dac_prepare();
+byte cv_dac_prepare();
 byte *cv_storage(int *len);
+byte *cv_cal_storage(int *len);
+byte *cv_mod_storage(int *len);
 
 // STORAGE
 void storage_read_patch();
 void storage_write_patch();
+void storage_begin_write();
+byte storage_run();
 
 //
 // END
@@ -24,6 +24,7 @@
 
 // INCLUDE FILES
 #include <system.h>
+#include <memory.h>
 #include "cvocd.h"
 
 
@@ -144,6 +145,13 @@ static GATE_OUT_CFG l_gate_cfg[GATE_MAX];
 // gate status
 static GATE_OUT l_gate[GATE_MAX];
 
+// routing table: bit mask of gates in MIDI note or CC modes
+// which listen to each MIDI channel
+static unsigned int l_gate_route[16];
+
+// bit map of the CC numbers that trigger any gate
+static byte l_gate_cc_used[16];
+
 //
 // LOCAL FUNCTIONS
 //
@@ -214,6 +222,7 @@ static void trigger(GATE_OUT *pgate, GATE_OUT_CFG *pcfg, byte which_gate, byte t
 	else
 	{
 		g_sync_sr_data &= ~gate_bit; // cancel any deferred trigger
+		g_sync_sr_armed &= ~gate_bit;
 		if(g_sr_data & gate_bit) {
 			g_sr_data &= ~gate_bit;			
 			g_sr_data_pending = 1;	
@@ -303,17 +312,17 @@ void gate_event(byte event, byte stack_id)
 // Note on has velocity > 0
 void gate_midi_note(byte chan, byte note, byte vel) 
 {
-	// for each gate output
-	for(byte which_gate=0; which_gate<GATE_MAX; ++which_gate) {
+	// for each gate output listening on the channel
+	unsigned int mask = l_gate_route[chan];
+	for(byte which_gate=0; mask; ++which_gate, mask>>=1) {
+		if(!(mask & 1))
+			continue;
 		GATE_OUT *pgate = &l_gate[which_gate];
 		GATE_OUT_CFG *pcfg = &l_gate_cfg[which_gate];
 		
 		// does this gate respond to midi note?
 		if(pcfg->event.mode != GATE_MIDI_NOTE)
 			continue;			
-		// does the MIDI channel match?
-		if(!IS_CHAN(pcfg->note.chan, chan))
-			continue;			
 		// Does the note match?
 		if(!IS_NOTE_MATCH(pcfg->note.note, pcfg->note.note_max, note))
 			continue;			
@@ -331,8 +340,15 @@ void gate_midi_note(byte chan, byte note, byte vel)
 // HANDLE EVENT FROM RAW MIDI CC
 void gate_midi_cc(byte chan, byte cc, byte value) 
 {
-	// for each gate output
-	for(byte which_gate=0; which_gate<GATE_MAX; ++which_gate) {
+	// is the CC used by any gate?
+	if(!gate_uses_cc(cc))
+		return;
+		
+	// for each gate output listening on the channel
+	unsigned int mask = l_gate_route[chan];
+	for(byte which_gate=0; mask; ++which_gate, mask>>=1) {
+		if(!(mask & 1))
+			continue;
 		GATE_OUT *pgate = &l_gate[which_gate];
 		GATE_OUT_CFG *pcfg = &l_gate_cfg[which_gate];
 		
@@ -345,10 +361,6 @@ void gate_midi_cc(byte chan, byte cc, byte value)
 		if(cc != pcfg->cc.cc) {
 			continue;
 		}		
-		// does the MIDI channel match?
-		if(!IS_CHAN(pcfg->cc.chan, chan))
-			continue;
-
 				
 		// has the value just gone above threshold?
 		if(value >= pcfg->cc.threshold &&
@@ -371,6 +383,13 @@ void gate_midi_cc(byte chan, byte cc, byte value)
 	}			
 }
 
+////////////////////////////////////////////////////////////
+// CHECK IF ANY GATE IS TRIGGERED BY A CC NUMBER
+byte gate_uses_cc(byte cc)
+{
+	return !!(l_gate_cc_used[cc>>3] & (1<<(cc&7)));
+}
+
 ////////////////////////////////////////////////////////////
 // HANDLE EVENT FROM RAW MIDI CLOCK MESSAGE
 void gate_midi_clock(byte msg) {
@@ -469,6 +488,48 @@ void gate_trigger(byte which_gate, byte trigger_enabled)
 	}
 }
 
+////////////////////////////////////////////////////////////
+// BUILD ROUTING TABLES FROM GATE CONFIG
+void gate_route() {
+	memset(l_gate_cc_used, 0, sizeof(l_gate_cc_used));
+	for(byte chan=0; chan<16; ++chan) {
+		unsigned int mask = 0;
+		for(byte which_gate=0; which_gate<GATE_MAX; ++which_gate) {
+			GATE_OUT_CFG *pcfg = &l_gate_cfg[which_gate];
+			switch(pcfg->event.mode) {
+			case GATE_MIDI_CC:
+			case GATE_MIDI_CC_NEG:
+				l_gate_cc_used[pcfg->cc.cc>>3] |= (1<<(pcfg->cc.cc&7));
+				// fall through
+			case GATE_MIDI_NOTE:
+				if(IS_CHAN(pcfg->note.chan, chan)) { // relies on alignment of chan member in cc too
+					mask |= ((unsigned int)1<<which_gate);
+				}
+				break;
+			}
+		}
+		l_gate_route[chan] = mask;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// GET MIDI INPUT FILTER BITS FOR A CHANNEL
+byte gate_filter(byte chan) {
+	byte filter = 0;
+	unsigned int mask = l_gate_route[chan];
+	for(byte which_gate=0; mask; ++which_gate, mask>>=1) {
+		if(mask & 1) {
+			if(l_gate_cfg[which_gate].event.mode == GATE_MIDI_NOTE) {
+				filter |= MIDI_FILTER_NOTE;
+			}
+			else {
+				filter |= MIDI_FILTER_CC;
+			}
+		}
+	}
+	return filter;
+}
+
 ////////////////////////////////////////////////////////////
 // SET DEFAULT GATE STATE
 void gate_reset() {
@@ -501,6 +562,7 @@ void gate_init() {
 		pcfg->event.flags = 0;
 		pcfg->event.duration = DEFAULT_GATE_DURATION;
 	}	
+	gate_route();
 	gate_reset();
 }
 
@@ -68,11 +68,42 @@ byte global_nrpn(byte param_lo, byte value_hi, byte value_lo)
 		}
 		break;
 	
+	////////////////////////////////////////////////////////////////
+	// SELECT SOFT MIDI THRU MODE
+	case NRPNL_THRU:
+		if(value_lo <= THRU_UNUSED) {
+			g_global.thru = value_lo;
+			return 1;
+		}
+		break;
+	
+	////////////////////////////////////////////////////////////////
+	// SET SYSEX DEVICE ID
+	case NRPNL_DEVICE_ID:
+		if(value_lo < SYSEX_DEVICE_ALL) {
+			g_global.device_id = value_lo;
+			return 1;
+		}
+		break;
+	
+	////////////////////////////////////////////////////////////////
+	// SET DAC REFRESH PERIOD (note changes are always sent at once)
+	case NRPNL_DAC_PERIOD:
+		g_global.dac_period = value_lo;
+		return 1;
+	
 	////////////////////////////////////////////////////////////////
 	// SAVE
 	case NRPNL_SAVE:
 		storage_write_patch();	// store to EEPROM 
 		return 1;
+		
+	////////////////////////////////////////////////////////////////
+	// STATISTICS REPORT (value 1 clears the statistics instead)
+	// This does not change the config
+	case NRPNL_STATS:
+		stats_request(value_lo);
+		return 0;
 	}
 	return 0;
 }
@@ -89,6 +120,9 @@ byte *global_storage(int *len) {
 void global_init() {
 	g_global.chan = DEFAULT_MIDI_CHANNEL; // default MIDI channel
 	g_global.gate_duration = DEFAULT_GATE_DURATION; // default gate duration
+	g_global.thru = THRU_OFF; // MIDI output not used for THRU
+	g_global.device_id = 0; // sysex device id
+	g_global.dac_period = DEFAULT_DAC_PERIOD; // ms between DAC refreshes
 }
 
 //
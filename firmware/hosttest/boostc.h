@@ -0,0 +1,47 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST BUILD SHIMS
+//
+// Stands in for the BoostC system header so the firmware 
+// sources can be built with gcc for the host tests. The
+// sources are first passed through boostc2c.sh, which turns 
+// register bit access (reg.N) into reg_bN variables and maps
+// int and long onto types of the BoostC sizes (16 and 32 bit).
+// Structures must be built with -fpack-struct=1 to match the
+// PIC layout.
+//
+//////////////////////////////////////////////////////////////
+#ifndef BOOSTC_H
+#define BOOSTC_H
+
+#include <string.h>
+
+#define __bc_int	short
+#define __bc_long	int
+
+#define true 1
+#define false 0
+
+// special function registers, and each of their bits (defined 
+// in shim.c, which sets BOOSTC_SHIM)
+#ifdef BOOSTC_SHIM
+#define SFR_CLASS
+#else
+#define SFR_CLASS extern
+#endif
+#define SFR(r) SFR_CLASS volatile unsigned char r, r##_b0, r##_b1, r##_b2, \
+	r##_b3, r##_b4, r##_b5, r##_b6, r##_b7;
+SFR(eecon1) SFR(tmr0) SFR(rcreg) SFR(txreg) SFR(ssp1buf) SFR(ssp1add)
+SFR(ssp1con1) SFR(ssp1con2) SFR(ssp1stat) SFR(osccon) SFR(trisa) SFR(trisc)
+SFR(ansela) SFR(anselc) SFR(porta) SFR(portc) SFR(lata) SFR(latc) 
+SFR(spbrg) SFR(spbrgh) SFR(tmr1l) SFR(tmr1h) SFR(t1con) SFR(t1gcon) 
+SFR(tmr2) SFR(pr2) SFR(t2con) SFR(pir1) SFR(pie1) SFR(pir2) SFR(pie2) 
+SFR(intcon) SFR(option_reg) SFR(rcsta) SFR(txsta) SFR(baudcon)
+#undef SFR
+
+// library functions
+void delay_ms(unsigned char ms);
+void eeprom_write(unsigned char addr, unsigned char data);
+unsigned char eeprom_read(unsigned char addr);
+
+#endif
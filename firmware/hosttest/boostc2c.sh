@@ -0,0 +1,19 @@
+#!/bin/sh
+# Translate the BoostC firmware sources in $1 into host C in $2
+# (see boostc.h)
+src=$1
+dst=$2
+mkdir -p $dst
+for f in $src/*.c $src/*.h; do
+	sed -E \
+		-e 's/\b([a-z][a-z0-9_]*)\.([0-7])\b/\1_b\2/g' \
+		-e 's/\bint\b/__bc_int/g' \
+		-e 's/\blong\b/__bc_long/g' \
+		-e 's/^rom char \*([a-z0-9_]+) = \{/const unsigned char \1[] = {/' \
+		-e 's/#include <system.h>/#include "boostc.h"/' \
+		-e 's/#include <(rand|eeprom).h>//' \
+		-e 's/^void main\(\)/void firmware_main()/' \
+		-e 's/^extern char (g_led_._timeout)/extern byte \1/' \
+		-e 's/^extern byte (g_cv_dac_pending)/extern volatile byte \1/' \
+		$f > $dst/$(basename $f)
+done
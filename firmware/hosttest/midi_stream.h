@@ -0,0 +1,173 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST TESTS: MIDI TEST STREAMS
+//
+// Builds a repeatable pseudo random MIDI byte stream that is
+// dense in bend and controller messages, with running status,
+// clock bytes dropped in anywhere (even between data bytes),
+// sysex for other devices and system common messages. Also
+// a simple reference parser that splits a stream into
+// messages, for comparing streams
+//
+//////////////////////////////////////////////////////////////
+#ifndef MIDI_STREAM_H
+#define MIDI_STREAM_H
+
+static unsigned long midi_rand_state;
+
+static unsigned int midi_rand(unsigned int range) {
+	midi_rand_state = midi_rand_state * 1103515245UL + 12345UL;
+	return ((midi_rand_state >> 16) & 0x7FFF) % range;
+}
+
+// Fill buf with len bytes of MIDI. Channel messages use
+// channels 0 to chans-1
+static void midi_stream(unsigned char *buf, int len, unsigned long seed, int chans) {
+	unsigned char msg[16];
+	unsigned char running = 0;
+	int pos = 0;
+	midi_rand_state = seed;
+	while(pos < len) {
+		int n = 0;
+		int r = midi_rand(100);
+		int chan = midi_rand(chans);
+		unsigned char status = 0;
+		if(r < 35) {
+			status = 0xE0|chan;
+			msg[n++] = midi_rand(128);
+			msg[n++] = midi_rand(128);
+		}
+		else if(r < 65) {
+			status = 0xB0|chan;
+			msg[n++] = midi_rand(120);
+			msg[n++] = midi_rand(128);
+		}
+		else if(r < 80) {
+			status = (midi_rand(2)? 0x90 : 0x80)|chan;
+			msg[n++] = midi_rand(128);
+			msg[n++] = midi_rand(128);
+		}
+		else if(r < 85) {
+			status = 0xD0|chan;
+			msg[n++] = midi_rand(128);
+		}
+		else if(r < 88) {
+			status = 0xC0|chan;
+			msg[n++] = midi_rand(128);
+		}
+		else if(r < 90) {
+			status = 0xA0|chan;
+			msg[n++] = midi_rand(128);
+			msg[n++] = midi_rand(128);
+		}
+		else if(r < 94) {
+			msg[n++] = 0xF8;
+		}
+		else if(r < 96) {
+			// sysex for some other device
+			msg[n++] = 0xF0;
+			msg[n++] = 0x7D;
+			int count = 2 + midi_rand(8);
+			while(count--)
+				msg[n++] = midi_rand(128);
+			msg[n++] = 0xF7;
+			running = 0;
+		}
+		else if(r < 98) {
+			msg[n++] = 0xF1;
+			msg[n++] = midi_rand(128);
+			running = 0;
+		}
+		else if(r < 99) {
+			msg[n++] = 0xF2;
+			msg[n++] = midi_rand(128);
+			msg[n++] = midi_rand(128);
+			running = 0;
+		}
+		else {
+			msg[n++] = 0xFE;
+		}
+		if(status) {
+			// channel message, usually with running status
+			// when it is the same as the last one
+			if(status != running || midi_rand(10) < 3) {
+				if(pos < len)
+					buf[pos++] = status;
+			}
+			running = status;
+			for(int i=0; i<n && pos < len; ++i) {
+				if(midi_rand(100) < 3 && pos < len)
+					buf[pos++] = 0xF8;
+				if(pos < len)
+					buf[pos++] = msg[i];
+			}
+		}
+		else {
+			for(int i=0; i<n && pos < len; ++i)
+				buf[pos++] = msg[i];
+		}
+	}
+}
+
+// a message split from a stream by midi_parse. For sysex, the
+// data bytes are summed into data[0] and data[1] is the first
+// data byte (the manufacturer id)
+typedef struct {
+	unsigned char status;
+	unsigned char data[2];
+	long last;			// index of the byte that completed it
+} MIDI_MSG;
+
+// Split a MIDI stream into complete messages, in the order
+// they complete. Returns the number of messages
+static int midi_parse(const unsigned char *buf, int len, MIDI_MSG *out) {
+	int count = 0;
+	unsigned char running = 0, need = 0, have = 0;
+	unsigned char data[2];
+	int sysex = 0, sysex_sum = 0, sysex_id = 0, sysex_len = 0;
+	for(int i=0; i<len; ++i) {
+		unsigned char b = buf[i];
+		if(b >= 0xF8) {
+			out[count].status = b;
+			out[count].data[0] = out[count].data[1] = 0;
+			out[count++].last = i;
+		}
+		else if(b & 0x80) {
+			if(sysex && b == 0xF7) {
+				out[count].status = 0xF0;
+				out[count].data[0] = sysex_sum;
+				out[count].data[1] = sysex_id;
+				out[count++].last = i;
+			}
+			sysex = (b == 0xF0);
+			sysex_sum = sysex_len = 0;
+			running = (b < 0xF0 || b == 0xF1 || b == 0xF2 || b == 0xF3)? b : 0;
+			switch(b & 0xF0) {
+			case 0xC0: case 0xD0: need = 1; break;
+			case 0xF0: need = (b == 0xF2)? 2 : 1; break;
+			default: need = 2; break;
+			}
+			have = 0;
+		}
+		else if(sysex) {
+			if(!sysex_len++)
+				sysex_id = b;
+			sysex_sum += b;
+		}
+		else if(running) {
+			data[have++] = b;
+			if(have == need) {
+				out[count].status = running;
+				out[count].data[0] = data[0];
+				out[count].data[1] = (need > 1)? data[1] : 0;
+				out[count++].last = i;
+				have = 0;
+				if(running >= 0xF0)
+					running = 0;	// no running status for system common
+			}
+		}
+	}
+	return count;
+}
+
+#endif
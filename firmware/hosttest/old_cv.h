@@ -0,0 +1,77 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST TESTS: OLD NOTE ARITHMETIC
+//
+// cv_update, cv_write_note and cv_write_note_hzvolt from 
+// before the note tables, used as the reference by the pitch
+// tests. They return the DAC value instead of storing it. 
+// Include after cv.c
+//
+//////////////////////////////////////////////////////////////
+#ifndef OLD_CV_H
+#define OLD_CV_H
+
+static int old_update(byte which, __bc_int value) {
+	if(l_cv[which].event.scale) {
+		__bc_long scale = (__bc_long)l_cv[which].event.scale - 64;
+		__bc_long ofs = (__bc_long)l_cv[which].event.ofs - 64;
+		value = (((__bc_long)value * (4096 + scale))/4096) + ofs;
+	}
+	if(value < 0)
+		value = 0;
+	if(value > 4095)
+		value = 4095;
+	return value;
+}
+
+static int old_write_note(byte which, __bc_long note, __bc_int pitch_bend, __bc_long dacs_per_oct) {
+	note <<= 8;
+	note += pitch_bend;
+	note *= dacs_per_oct;
+	note /= 12;
+	note >>= 8;
+	return old_update(which, note);
+}
+
+static int old_write_note_hzvolt(byte which, __bc_long note, __bc_int pitch_bend) {
+	note <<= 8;
+	note += pitch_bend;
+	pitch_bend = note & 0xFF;
+	note >>= 8;
+	__bc_int dac;
+	if(note == 72)
+		dac = 4000;
+	else switch((byte)note % 12) {
+		case 0: dac = 2000; break;
+		case 1: dac = 2119; break;
+		case 2: dac = 2245; break;
+		case 3: dac = 2378; break;
+		case 4: dac = 2520; break;
+		case 5: dac = 2670; break;
+		case 6: dac = 2828; break;
+		case 7: dac = 2997; break;
+		case 8: dac = 3175; break;
+		case 9: dac = 3364; break;
+		case 10: dac = 3564; break;
+		case 11: dac = 3775; break;
+	}
+	dac += (__bc_int)(((__bc_long)dac*244*pitch_bend)/0x100000L);
+	byte octave = ((byte)note)/12;
+	if(octave > 5) octave = 5;
+	dac >>= (5-octave);
+	return old_update(which, dac);
+}
+
+// old DAC value for a pitch in MIDI note * 256 units
+static int old_pitch(byte which, __bc_long pitch) {
+	switch(l_cv[which].event.mode) {
+	case CV_NOTE_HZV:
+		return old_write_note_hzvolt(which, pitch>>8, pitch & 0xFF);
+	case CV_NOTE_12VO:
+		return old_write_note(which, pitch>>8, pitch & 0xFF, 600);
+	default:
+		return old_write_note(which, pitch>>8, pitch & 0xFF, 500);
+	}
+}
+
+#endif
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Report the static RAM used by each firmware module, from host
+# objects built with the BoostC type sizes (see boostc.h). This
+# counts globals and static locals only; BoostC also allocates 
+# function locals and parameters statically (overlaid according
+# to the call tree), which are not included
+RAM_SIZE=1024
+total=0
+for obj in "$@"; do
+	bytes=0
+	for size in $(nm -S "$obj" | awk 'NF==4 && $3 ~ /^[bBdD]$/ {print $2}'); do
+		bytes=$((bytes + 0x$size))
+	done
+	printf "%-12s %5d\n" $(basename $obj .o) $bytes
+	total=$((total + bytes))
+done
+printf "%-12s %5d of %d bytes (%d free for locals)\n" total $total $RAM_SIZE $((RAM_SIZE - total))
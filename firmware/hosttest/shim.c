@@ -0,0 +1,22 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST BUILD SHIMS
+//
+// Definitions behind boostc.h: register variables and the
+// BoostC library functions the firmware uses. EEPROM is a
+// plain array, and delays return straight away
+//
+//////////////////////////////////////////////////////////////
+#define BOOSTC_SHIM
+#include "boostc.h"
+
+unsigned char g_host_eeprom[256];
+
+void delay_ms(unsigned char ms) {
+}
+void eeprom_write(unsigned char addr, unsigned char data) {
+	g_host_eeprom[addr] = data;
+}
+unsigned char eeprom_read(unsigned char addr) {
+	return g_host_eeprom[addr];
+}
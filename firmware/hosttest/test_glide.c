@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST TEST: GLIDE AND SMOOTHING START AND STOP
+//
+// Checks that a note CV output only glides from a pitch it
+// has already played: not after boot, nor after its source
+// has been changed (when the glide position holds an LFO
+// phase), but still from the last note after a release. Also
+// checks that a config change during a glide or smoothing 
+// finishes it at its target rather than leaving the output 
+// partway, and that smoothing starts from the value on the
+// output.
+//
+// The translated cv.c is included so its static data can be
+// reached.
+//
+//////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include "cv.c"
+
+#define GLIDE_TIME	10		// glide setting
+#define GLIDE_MS	(GLIDE_TIME * 16)	// ..and the time it takes
+
+// DAC value of a pitch (MIDI note * 256) on output 0
+static int pitch_dac(long pitch) {
+	int dac = l_dac[0];
+	cv_write_pitch(0, pitch);
+	int value = l_dac[0];
+	l_dac[0] = dac;
+	return value;
+}
+
+static void note_source() {
+	cv_nrpn(0, NRPNL_SRC, NRPVH_SRC_STACK1, NRPVL_SRC_NOTE1);
+	cv_nrpn(0, NRPNL_GLIDE_TIME, NRPVH_GLIDE_TIME, GLIDE_TIME);
+}
+
+static void run_ms(int ms) {
+	while(ms--) {
+		cv_run();
+	}
+}
+
+// is the output between two uncalibrated DAC values (and
+// not at either)?
+static int between(int from, int to) {
+	int lo = cv_cal(0, (from < to)? from : to);
+	int hi = cv_cal(0, (from < to)? to : from);
+	return l_dac[0] > lo && l_dac[0] < hi;
+}
+
+static int check(const char *name, int ok) {
+	printf("%-48s %s\n", name, ok? "yes" : "NO");
+	return !ok;
+}
+
+int main() {
+	int fail = 0;
+	memset(l_cv, 0, sizeof(l_cv));
+	memset(l_cal_point, 64, sizeof(l_cal_point));
+	l_mod_active = 0;
+	l_note_table_stale = 0x0F;
+	cv_reset();
+
+	// after boot
+	note_source();
+	cv_glide_to(0, 48L<<8, 1);
+	fail |= check("first note after boot is at pitch at once",
+		!(l_gliding & 1) && l_dac[0] == pitch_dac(48L<<8));
+
+	// config change part way through a glide
+	cv_glide_to(0, 60L<<8, 1);
+	run_ms(GLIDE_MS/2);
+	int partway = l_dac[0];
+	cv_nrpn(0, NRPNL_TRANSPOSE, 0, TRANSPOSE_NONE);
+	fail |= check("config change finishes a glide at its target",
+		partway != pitch_dac(60L<<8) && !(l_gliding & 1) &&
+		l_dac[0] == pitch_dac(60L<<8) && l_glide_pos[0] == (60L<<16));
+
+	// after a release, glide is still from the last note
+	l_note_held = 0;
+	cv_glide_to(0, 40L<<8, 1);
+	fail |= check("note after a release glides from the last",
+		(l_gliding & 1) && l_dac[0] == pitch_dac(60L<<8));
+	run_ms(GLIDE_MS + GLIDE_UPDATE_MS);
+	fail |= check("..and arrives",
+		!(l_gliding & 1) && l_dac[0] == pitch_dac(40L<<8));
+
+	// after the source was an LFO for a while
+	cv_nrpn(0, NRPNL_SRC, NRPVH_SRC_LFO, NRPVL_LFO_TRIANGLE);
+	run_ms(100);
+	note_source();
+	cv_glide_to(0, 72L<<8, 1);
+	fail |= check("first note after an LFO is at pitch at once",
+		!(l_gliding & 1) && l_dac[0] == pitch_dac(72L<<8));
+
+	// config change part way through smoothing
+	cv_nrpn(0, NRPNL_SRC, NRPVH_SRC_MIDICC, 1);
+	cv_write_smooth(0, 0);
+	cv_nrpn(0, NRPNL_SLEW, 0, 4);
+	cv_write_smooth(0, 4000);
+	run_ms(4);
+	partway = l_dac[0];
+	cv_nrpn(0, NRPNL_SLEW, 0, 4);
+	fail |= check("config change finishes smoothing at its target",
+		partway != cv_cal(0, 4000) && !(l_slewing & 1) && l_dac[0] == cv_cal(0, 4000));
+
+	// smoothing turned on after unsmoothed values
+	cv_nrpn(0, NRPNL_SLEW, 0, 0);
+	cv_write_smooth(0, 3000);
+	cv_nrpn(0, NRPNL_SLEW, 0, 4);
+	cv_write_smooth(0, 3400);
+	run_ms(1);
+	fail |= check("smoothing turned on starts from the output",
+		between(3000, 3400));
+
+	// reset of a smoothed bend output
+	cv_nrpn(0, NRPNL_SRC, NRPVH_SRC_MIDIBEND, 0);
+	byte volts = l_cv[0].event.volts;
+	cv_write_bend(0, 16383, volts);
+	cv_nrpn(0, NRPNL_SLEW, 0, 4);
+	cv_reset();
+	run_ms(1);
+	fail |= check("reset of a smoothed bend starts from the output",
+		between(((long)8192 * volts)>>5, ((long)16383 * volts)>>5));
+
+	printf("%s\n", fail? "FAIL" : "PASS");
+	return fail;
+}
@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST TEST: HZ/V PITCH ACCURACY
+//
+// Reports the worst case pitch error of Hz/V note CV, in
+// cents against floating point, for every 1/256 semitone
+// from C0 to C6 with no calibration. The old arithmetic
+// (old_cv.h) is measured alongside, and so is the error of
+// just rounding the exact value to a DAC step, which no
+// method can beat.
+//
+//////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <math.h>
+#include "cv.c"
+#include "old_cv.h"
+
+// exact DAC value: 2000 counts at C5 (note 60), doubling
+// with each octave
+static double ideal_dac(long pitch) {
+	return 2000.0 * pow(2.0, (pitch/256.0 - 60.0)/12.0);
+}
+
+static double cents(double dac, double ideal) {
+	return fabs(1200.0 * log2(dac/ideal));
+}
+
+int main() {
+	int fail = 0;
+	memset(l_cv, 0, sizeof(l_cv));
+	memset(l_cal_point, 64, sizeof(l_cal_point));
+	l_mod_active = 0;
+	l_cv[0].event.mode = CV_NOTE_HZV;
+	cv_note_table(0);
+
+	printf("worst case error in cents\n");
+	printf("%-7s %6s %8s %8s %8s %14s\n", "octave", "DAC", "old", "new", "rounding", "new-rounded");
+	for(int octave=0; octave<6; ++octave) {
+		double err_old = 0, err_new = 0, err_round = 0;
+		int steps_off = 0;
+		for(long pitch = octave*12*256; pitch < (octave+1)*12*256; ++pitch) {
+			double ideal = ideal_dac(pitch);
+			cv_write_pitch(0, pitch);
+			int dac = l_dac[0];
+			int old = old_pitch(0, pitch);
+			double e;
+			if((e = cents(old, ideal)) > err_old)
+				err_old = e;
+			if((e = cents(dac, ideal)) > err_new)
+				err_new = e;
+			if((e = cents(round(ideal), ideal)) > err_round)
+				err_round = e;
+			int off = abs(dac - (int)round(ideal));
+			if(off > steps_off)
+				steps_off = off;
+		}
+		printf("C%-6d %6d %8.2f %8.2f %8.2f %11d DAC\n",
+			octave, (int)round(ideal_dac(octave*12*256)), err_old, err_new, err_round, steps_off);
+		// must be within one DAC step of exact, and no worse 
+		// than the old arithmetic
+		if(steps_off > 1 || err_new > err_old) {
+			fail = 1;
+		}
+	}
+	printf("%s\n", fail? "FAIL" : "PASS");
+	return fail;
+}
@@ -0,0 +1,381 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST TEST: NOTE TO GATE LATENCY
+//
+// Runs the firmware main loop against models of the MIDI
+// input, the I2C bus to the DAC and the gate shift registers,
+// and measures how long a note takes to reach its CV and its
+// gate. The firmware's own latency statistics (as sent in the
+// sysex report) are read back alongside and must agree with
+// the worst note to gate time seen (their minimum comes from
+// note off, which closes the gate at once). Also checks that
+// a synchronised gate never opens before its CV has been sent.
+//
+// Only the hardware is timed. Each pass of the main loop is
+// taken to cost LOOP_US whatever it does, so the CPU time of
+// the PIC is not modelled.
+//
+// The translated cvocd.c is included so its static data can
+// be reached, with I2C and shift register accesses routed to
+// the models. storage.c is replaced: storage_run(), called
+// once per pass of the main loop, runs the simulation.
+//
+//////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "boostc.h"
+
+#ifndef LOOP_US
+#define LOOP_US		50		// time taken by each pass of the main loop
+#endif
+#define FOSC_MHZ	16		// oscillator (instruction clock is FOSC/4)
+#define BYTE_US		320		// MIDI byte time
+#define GATE_BIT	0x0004	// shift register bit of gate 1 (SRB_NOTE1)
+#define DAC_CHAN	3		// DAC channel of CV 1 (D)
+#define MAX_EVENTS	4000
+
+static long sim_time;		// us
+static int sim_running;
+
+//
+// I2C MODEL
+// A start, data byte or stop takes a bit time (9 for a byte
+// with its ACK) at the rate set by ssp1add, then sets SSP1IF.
+// Data bytes are decoded as DAC writes (fast write of all
+// channels, or multi-write of some) when the stop completes
+//
+enum { I2C_IDLE, I2C_START, I2C_BYTE, I2C_STOP };
+static unsigned char i2c_flag;
+static unsigned char i2c_byte;
+static int i2c_op;
+static long i2c_done;
+static unsigned char i2c_xfer[16];
+static int i2c_len;
+static int dac_value[4] = {-1, -1, -1, -1};
+static long dac_time[4];	// time each channel last changed
+
+static volatile unsigned char *i2c_if() {
+	// SSP1IF: until the simulation starts, the blocking
+	// I2C calls made at startup complete at once
+	if(!sim_running) {
+		i2c_flag = 1;
+	}
+	return &i2c_flag;
+}
+
+static volatile unsigned char *i2c_buf() {
+	if(!sim_running) {
+		return &i2c_byte;
+	}
+	i2c_op = I2C_BYTE;
+	i2c_done = sim_time + 9 * 4 * (ssp1add + 1) / FOSC_MHZ;
+	return &i2c_byte;
+}
+
+static void i2c_complete() {
+	switch(i2c_op) {
+	case I2C_START:
+		ssp1con2_b0 = 0;
+		i2c_len = 0;
+		break;
+	case I2C_BYTE:
+		if(i2c_len < sizeof(i2c_xfer)) {
+			i2c_xfer[i2c_len++] = i2c_byte;
+		}
+		break;
+	case I2C_STOP:
+		ssp1con2_b2 = 0;
+		if(i2c_len == 9 && !(i2c_xfer[1] & 0xC0)) {
+			// fast write: channels A to D
+			for(int chan=0; chan<4; ++chan) {
+				int value = (i2c_xfer[1+2*chan] & 0x0F)<<8 | i2c_xfer[2+2*chan];
+				if(value != dac_value[chan]) {
+					dac_value[chan] = value;
+					dac_time[chan] = sim_time;
+				}
+			}
+		}
+		else {
+			// multi-write: 3 bytes per channel
+			for(int i=1; i+2<i2c_len; i+=3) {
+				int chan = (i2c_xfer[i]>>1) & 3;
+				int value = (i2c_xfer[i+1] & 0x0F)<<8 | i2c_xfer[i+2];
+				if(value != dac_value[chan]) {
+					dac_value[chan] = value;
+					dac_time[chan] = sim_time;
+				}
+			}
+		}
+		break;
+	}
+	i2c_op = I2C_IDLE;
+	i2c_flag = 1;
+}
+
+//
+// SHIFT REGISTER MODEL
+// Pin writes are applied on the next pin access, once the
+// assignment has completed
+//
+static unsigned char sr_slot;
+static int sr_pending = -1;
+static unsigned char sr_pins[8];
+static unsigned int sr_shift_lo, sr_shift_hi;
+static unsigned int sr_out;
+
+static void sr_flush() {
+	if(sr_pending < 0) {
+		return;
+	}
+	int pin = sr_pending;
+	unsigned char value = sr_slot;
+	sr_pending = -1;
+	if(pin == 4 && value && !sr_pins[4]) {
+		// clock rising edge: shift in a bit of each half
+		sr_shift_lo = (sr_shift_lo<<1 | sr_pins[0]) & 0xFF;
+		sr_shift_hi = (sr_shift_hi<<1 | sr_pins[1]) & 0xFF;
+	}
+	if(pin == 5 && value && !sr_pins[5]) {
+		// latch rising edge: outputs change
+		sr_out = sr_shift_hi<<8 | sr_shift_lo;
+	}
+	sr_pins[pin] = !!value;
+}
+
+static volatile unsigned char *sr_pin(int pin) {
+	sr_flush();
+	sr_pending = pin;
+	return &sr_slot;
+}
+
+#define pir1_b3	(*i2c_if())
+#define ssp1buf	(*i2c_buf())
+#define lata_b0	(*sr_pin(0))
+#define lata_b1	(*sr_pin(1))
+#define lata_b4	(*sr_pin(4))
+#define lata_b5	(*sr_pin(5))
+#include "cvocd.c"
+#undef pir1_b3
+#undef ssp1buf
+#undef lata_b0
+#undef lata_b1
+#undef lata_b4
+#undef lata_b5
+extern __bc_int l_dac[];
+
+//
+// MIDI INPUT
+// Note on every 20ms for note 1 of the stack on channel 1,
+// with note off 10ms later. Optionally the gaps are filled
+// with CC 1 at the full MIDI rate, driving CV 2
+//
+#define NOTES		50
+#define NOTE_MS		20
+#define NOTE_SLOTS	(NOTE_MS * 1000 / BYTE_US)	// byte times per note
+static unsigned char in_byte[NOTES * NOTE_SLOTS + 16];
+static int in_len, in_next;
+static long note_arrive[NOTES];		// time each note on was received
+
+static void midi_put(unsigned char status, unsigned char param1, unsigned char param2) {
+	in_byte[in_len++] = status;
+	in_byte[in_len++] = param1;
+	in_byte[in_len++] = param2;
+}
+
+static void midi_build(int with_cc) {
+	in_len = 0;
+	while(in_len < 16) {
+		in_byte[in_len++] = 0xFE;	// active sensing as filler
+	}
+	for(int n=0; n<NOTES; ++n) {
+		int on_at = 16 + n * NOTE_SLOTS;
+		int off_at = on_at + NOTE_SLOTS/2;
+		int next_on = on_at + NOTE_SLOTS;
+		byte note = 36 + (n * 7) % 48;
+		midi_put(0x90, note, 100);
+		note_arrive[n] = (long)in_len * BYTE_US;
+		while(in_len < next_on) {
+			int next = (in_len < off_at)? off_at : next_on;
+			if(in_len == off_at) {
+				midi_put(0x80, note, 0);
+			}
+			else if(with_cc && in_len + 3 <= next) {
+				midi_put(0xB0, 1, (in_len * 5) & 0x7F);
+			}
+			else {
+				in_byte[in_len++] = 0xFE;
+			}
+		}
+	}
+}
+
+//
+// SIMULATION
+// storage_run() is called once per pass of the main loop.
+// It advances the models by LOOP_US, running the interrupt
+// for each hardware event on the way
+//
+static jmp_buf sim_end;
+static long next_ms;
+static unsigned int last_sr_out;
+static long cv_wait[NOTES], gate_wait[NOTES];
+static int notes_seen, early_gates;
+
+static void check_gate() {
+	if((sr_out & GATE_BIT) && !(last_sr_out & GATE_BIT)) {
+		// gate has opened: find the note it belongs to
+		int n = notes_seen;
+		if(n < NOTES && note_arrive[n] <= sim_time) {
+			gate_wait[n] = sim_time - note_arrive[n];
+			cv_wait[n] = dac_time[DAC_CHAN] - note_arrive[n];
+			// CV must already be at the note's pitch
+			if(dac_value[DAC_CHAN] != l_dac[0] || dac_time[DAC_CHAN] < note_arrive[n]) {
+				++early_gates;
+			}
+			++notes_seen;
+		}
+	}
+	last_sr_out = sr_out;
+}
+
+static void sim_step() {
+	long target = sim_time + LOOP_US;
+	sr_flush();
+	check_gate();
+	for(;;) {
+		// start any I2C operation the firmware has asked for
+		if(i2c_op == I2C_IDLE) {
+			if(ssp1con2_b0) {
+				i2c_op = I2C_START;
+				i2c_done = sim_time + 4 * (ssp1add + 1) / FOSC_MHZ;
+			}
+			else if(ssp1con2_b2) {
+				i2c_op = I2C_STOP;
+				i2c_done = sim_time + 4 * (ssp1add + 1) / FOSC_MHZ;
+			}
+		}
+		long next = target;
+		long rx = (in_next < in_len)? (long)(in_next + 1) * BYTE_US : -1;
+		if(rx >= 0 && rx < next)
+			next = rx;
+		if(next_ms < next)
+			next = next_ms;
+		if(i2c_op != I2C_IDLE && i2c_done < next)
+			next = i2c_done;
+		sim_time = next;
+		tmr1h = (sim_time/2)>>8;
+		tmr1l = (sim_time/2);
+		if(sim_time == rx) {
+			rcreg = in_byte[in_next++];
+			pir1_b5 = 1;
+		}
+		if(sim_time == next_ms) {
+			intcon_b2 = 1;
+			next_ms += 1000;
+		}
+		if(i2c_op != I2C_IDLE && sim_time == i2c_done) {
+			i2c_complete();
+		}
+		if(pir1_b5 || intcon_b2 || (pie1_b3 && i2c_flag)) {
+			interrupt();
+		}
+		if(sim_time >= target)
+			break;
+	}
+	if(in_next >= in_len && sim_time > (long)in_len * BYTE_US + 20000) {
+		longjmp(sim_end, 1);
+	}
+}
+
+// storage.c stand-ins
+void storage_read_patch() {}
+void storage_write_patch() {}
+void storage_begin_write() {}
+byte storage_run() {
+	static int configured;
+	if(!configured) {
+		// patch: stack 1 on channel 1, CV 1 and gate 1 from its
+		// first note, CV 2 from CC 1 (on the global channel 1)
+		configured = 1;
+		nrpn(NRPNH_STACK1, NRPNL_CHAN, NRPVH_CHAN_SPECIFIC, 1);
+		nrpn(NRPNH_STACK1, NRPNL_NOTE_MIN, 0, 0);
+		nrpn(NRPNH_STACK1, NRPNL_NOTE_MAX, 0, 127);
+		nrpn(NRPNH_CV1, NRPNL_SRC, NRPVH_SRC_STACK1, NRPVL_SRC_NOTE1);
+		nrpn(NRPNH_CV2, NRPNL_SRC, NRPVH_SRC_MIDICC, 1);
+		nrpn(NRPNH_GATE1, NRPNL_SRC, NRPVH_SRC_STACK1, NRPVL_SRC_NOTE1);
+		// drop what is left of the blocking writes at startup, 
+		// but not a transfer started by all_reset()
+		sim_running = 1;
+		i2c_flag = 0;
+		i2c_op = I2C_IDLE;
+		ssp1con2_b2 = 0;
+		if(!pie1_b3) {
+			ssp1con2_b0 = 0;
+		}
+	}
+	sim_step();
+	return 0;
+}
+
+static double mean(long *v, int n) {
+	double total = 0;
+	for(int i=0; i<n; ++i)
+		total += v[i];
+	return n? total/n : 0;
+}
+
+static long worst(long *v, int n) {
+	long w = 0;
+	for(int i=0; i<n; ++i)
+		if(v[i] > w)
+			w = v[i];
+	return w;
+}
+
+static int run(const char *name, int with_cc) {
+	midi_build(with_cc);
+	portc_b3 = 1;	// button not pressed
+	pir1_b4 = 1;	// UART transmitter idle
+	if(!setjmp(sim_end)) {
+		firmware_main();
+	}
+	unsigned int lat_min = 0, lat_max = 0;
+	stats_value(LAT_NOTE*16 + STAT_LAT_MIN, &lat_min);
+	stats_value(LAT_NOTE*16 + STAT_LAT_MAX, &lat_max);
+	printf("%-10s %4d %5d %7.0f %7ld %7.0f %7ld %8u %8u %6d\n", name, FOSC_MHZ * 1000 / (4 * (ssp1add + 1)), notes_seen,
+		mean(cv_wait, notes_seen), worst(cv_wait, notes_seen),
+		mean(gate_wait, notes_seen), worst(gate_wait, notes_seen),
+		lat_min * 2, lat_max * 2, early_gates);
+	long stats_diff = (long)lat_max * 2 - worst(gate_wait, notes_seen);
+	if(stats_diff < -LOOP_US || stats_diff > LOOP_US) {
+		printf("%s: statistics disagree with the gate by %ldus\n", name, stats_diff);
+		return 1;
+	}
+	return (notes_seen != NOTES || early_gates)? 1 : 0;
+}
+
+int main() {
+	int fail = 0;
+	printf("main loop pass %d us\n", LOOP_US);
+	printf("%-10s %4s %5s %15s %15s %17s %6s\n", "", "I2C", "", "note to CV(us)", "note to gate(us)", "stats NOTE(us)", "early");
+	printf("%-10s %4s %5s %7s %7s %7s %7s %8s %8s %6s\n", "input", "kHz", "notes", "mean", "worst", "mean", "worst", "min", "max", "gates");
+	// each run starts the firmware from scratch
+	static const char *names[] = {"notes", "notes+CC"};
+	for(int with_cc=0; with_cc<2; ++with_cc) {
+		fflush(stdout);
+		pid_t pid = fork();
+		if(!pid) {
+			exit(run(names[with_cc], with_cc));
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fail = 1;
+		}
+	}
+	printf("%s\n", fail? "FAIL" : "PASS");
+	return fail;
+}
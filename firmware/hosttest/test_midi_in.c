@@ -0,0 +1,315 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST TEST: MIDI INPUT PARSER
+//
+// Feeds a dense MIDI stream through the receive interrupt
+// parser and midi_in(), and through the old byte buffer and
+// midi_in() state machine (kept below as the reference).
+// Checks that both give the same messages, then times both.
+// Also checks that NRPN config is taken on any channel, and
+// that a bend is not skipped across a note.
+//
+// The translated cvocd.c is included so its static data can
+// be reached.
+//
+//////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <time.h>
+#include "cvocd.c"
+#include "midi_stream.h"
+
+//
+// REFERENCE: OLD MIDI INPUT
+// The receive interrupt and midi_in() from before the parser
+// moved into the interrupt. Sysex for this unit is not in the
+// test stream, so its handling is left out
+//
+
+#define OLD_SZ_RXBUFFER 			64
+#define OLD_SZ_RXBUFFER_MASK 		0x3F
+volatile byte old_rx_buffer[OLD_SZ_RXBUFFER];
+volatile byte old_rx_head = 0;
+volatile byte old_rx_tail = 0;
+byte old_midi_status = 0;
+byte old_midi_num_params = 0;
+byte old_midi_params[2];
+char old_midi_param = 0;
+byte old_sysex_state = SYSEX_NONE;
+
+static void old_interrupt() {
+	if(pir1_b5)
+	{
+		byte b = rcreg;
+		byte next_head = (old_rx_head + 1)&OLD_SZ_RXBUFFER_MASK;
+		if(next_head != old_rx_tail) {
+			old_rx_buffer[old_rx_head] = b;
+			old_rx_head = next_head;
+		}
+		LED_1_PULSE(LED_PULSE_MIDI_IN);
+		pir1_b5 = 0;
+	}
+}
+
+static byte old_midi_in()
+{
+	for(;;)
+	{
+		if(rcsta_b1)
+		{
+			rcsta_b4 = 0;
+			rcsta_b4 = 1;
+		}
+		if(old_rx_head == old_rx_tail)
+			return 0;
+		byte ch = old_rx_buffer[old_rx_tail];
+		++old_rx_tail;
+		old_rx_tail&=OLD_SZ_RXBUFFER_MASK;
+
+		if((ch & 0xf0) == 0xf0)
+		{
+			switch(ch)
+			{
+			case MIDI_SYNCH_TICK:
+			case MIDI_SYNCH_START:
+			case MIDI_SYNCH_CONTINUE:
+			case MIDI_SYNCH_STOP:
+				return ch;
+			case MIDI_MTC_QTR_FRAME:
+			case MIDI_SONG_SELECT:
+			case MIDI_SPP:
+				old_midi_param = 0;
+				old_midi_status = ch;
+				old_midi_num_params = (ch==MIDI_SPP)? 2:1;
+				break;
+			case MIDI_SYSEX_BEGIN:
+				old_sysex_state = SYSEX_ID0;
+				break;
+			case MIDI_SYSEX_END:
+				old_sysex_state = SYSEX_NONE;
+				break;
+			}
+		}
+		else if(!!(ch & 0x80))
+		{
+			old_sysex_state = SYSEX_NONE;
+			old_midi_param = 0;
+			old_midi_status = ch;
+			switch(ch & 0xF0)
+			{
+			case 0xC0:
+			case 0xD0:
+				old_midi_num_params = 1;
+				break;
+			default:
+				old_midi_num_params = 2;
+				break;
+			}
+		}
+		else
+		{
+			switch(old_sysex_state)
+			{
+			case SYSEX_ID0: old_sysex_state = (ch == MY_SYSEX_ID0)? SYSEX_ID1 : SYSEX_IGNORE; break;
+			case SYSEX_ID1: old_sysex_state = (ch == MY_SYSEX_ID1)? SYSEX_ID2 : SYSEX_IGNORE; break;
+			case SYSEX_ID2: old_sysex_state = (ch == MY_SYSEX_ID2)? SYSEX_PARAMH : SYSEX_IGNORE; break;
+			case SYSEX_IGNORE: break;
+			case SYSEX_NONE:
+				if(old_midi_status)
+				{
+					old_midi_params[old_midi_param++] = ch;
+					if(old_midi_param >= old_midi_num_params)
+					{
+						old_midi_param = 0;
+						switch(old_midi_status&0xF0)
+						{
+						case 0x80:
+						case 0x90:
+						case 0xE0:
+						case 0xB0:
+						case 0xD0:
+							return old_midi_status;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+//
+// TEST SETUP
+//
+
+#define STREAM_LEN	100000
+static byte stream[STREAM_LEN];
+
+// messages as seen by the main loop: channel messages and
+// clock messages are kept apart, since the new code gives
+// clock its own queue
+typedef struct {
+	byte status;
+	byte params[2];
+} MSG;
+static MSG old_msgs[STREAM_LEN], new_msgs[STREAM_LEN];
+static byte old_rt[STREAM_LEN], new_rt[STREAM_LEN];
+static long old_count, new_count, old_rt_count, new_rt_count;
+
+// the main loop is run after each byte, so messages
+// are never coalesced
+static void run_old() {
+	old_count = old_rt_count = 0;
+	for(long i=0; i<STREAM_LEN; ++i) {
+		rcreg = stream[i];
+		pir1_b5 = 1;
+		old_interrupt();
+		byte status;
+		while((status = old_midi_in())) {
+			if(status >= 0xF8) {
+				old_rt[old_rt_count++] = status;
+			}
+			else {
+				old_msgs[old_count].status = status;
+				old_msgs[old_count].params[0] = old_midi_params[0];
+				old_msgs[old_count].params[1] = old_midi_params[1];
+				++old_count;
+			}
+		}
+	}
+}
+
+static void run_new() {
+	new_count = new_rt_count = 0;
+	for(long i=0; i<STREAM_LEN; ++i) {
+		rcreg = stream[i];
+		pir1_b5 = 1;
+		interrupt();
+		while(rt_head != rt_tail) {
+			new_rt[new_rt_count++] = rt_queue[rt_tail].msg;
+			rt_tail = (rt_tail + 1)&SZ_RTQUEUE_MASK;
+		}
+		byte status;
+		while((status = midi_in())) {
+			new_msgs[new_count].status = status;
+			new_msgs[new_count].params[0] = midi_params[0];
+			new_msgs[new_count].params[1] = midi_params[1];
+			++new_count;
+		}
+	}
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+	int fail = 0;
+
+	// the patch listens to the message types that the old
+	// midi_in() returned, on every channel
+	g_global.thru = THRU_OFF;
+	route_pending = 0;
+	memset((void*)g_midi_filter, MIDI_FILTER_NOTE|MIDI_FILTER_CC|MIDI_FILTER_TOUCH|MIDI_FILTER_BEND, sizeof(g_midi_filter));
+	midi_stream(stream, STREAM_LEN, 1, 16);
+
+	// equivalence
+	run_old();
+	run_new();
+	long same = 0;
+	while(same < old_count && same < new_count &&
+		!memcmp(&old_msgs[same], &new_msgs[same], sizeof(MSG))) {
+		++same;
+	}
+	printf("channel messages: old %ld new %ld, first %ld the same\n", old_count, new_count, same);
+	if(same != old_count || same != new_count) {
+		fail = 1;
+	}
+	int rt_same = (old_rt_count == new_rt_count && !memcmp(old_rt, new_rt, old_rt_count));
+	printf("clock messages: old %ld new %ld, %s\n", old_rt_count, new_rt_count, rt_same? "the same" : "different");
+	if(!rt_same) {
+		fail = 1;
+	}
+	if(rx_stats[STAT_RX_LOST] || rx_stats[STAT_RX_DROPPED] || rx_stats[STAT_RX_COALESCED]) {
+		printf("messages lost %u dropped %u coalesced %u\n",
+			rx_stats[STAT_RX_LOST], rx_stats[STAT_RX_DROPPED], rx_stats[STAT_RX_COALESCED]);
+		fail = 1;
+	}
+
+	// NRPN config is taken on a channel the patch does not use
+	memset((void*)g_midi_filter, 0, sizeof(g_midi_filter));
+	static const byte nrpn_in[] = {0xB6, MIDI_CC_NRPN_HI, 1, MIDI_CC_NRPN_LO, 2, MIDI_CC_DATA_HI, 0, MIDI_CC_DATA_LO, 3};
+	rx_tail = rx_head;
+	for(int i=0; i<sizeof(nrpn_in); ++i) {
+		rcreg = nrpn_in[i];
+		pir1_b5 = 1;
+		interrupt();
+	}
+	int nrpn_count = 0;
+	while(midi_in()) {
+		++nrpn_count;
+	}
+	printf("NRPN on an unused channel: %d of 4 taken\n", nrpn_count);
+	if(nrpn_count != 4) {
+		fail = 1;
+	}
+	memset((void*)g_midi_filter, MIDI_FILTER_NOTE|MIDI_FILTER_CC|MIDI_FILTER_TOUCH|MIDI_FILTER_BEND, sizeof(g_midi_filter));
+
+	// a bend is only skipped for a newer one if no note on the
+	// same channel comes between them
+	static const byte bend_in[] = {0xE0, 0, 64, 0x90, 60, 100, 0xE0, 0, 65, 0xE0, 0, 66};
+	static const byte bend_out[] = {0xE0, 0x90, 0xE0};
+	for(int i=0; i<sizeof(bend_in); ++i) {
+		rcreg = bend_in[i];
+		pir1_b5 = 1;
+		interrupt();
+	}
+	byte status;
+	int bend_count = 0, bend_same = 1;
+	while((status = midi_in())) {
+		bend_same &= (bend_count < sizeof(bend_out) && status == bend_out[bend_count]);
+		++bend_count;
+	}
+	bend_same &= (bend_count == sizeof(bend_out) && midi_params[1] == 66);
+	printf("bend, note, bend, bend: %d messages, %s\n", bend_count, bend_same? "as expected" : "wrong");
+	if(!bend_same) {
+		fail = 1;
+	}
+
+	// throughput per received byte: interrupt plus main loop,
+	// then the interrupt alone (with the queue emptied straight 
+	// away), the difference being the main loop's share
+	const int reps = 50;
+	double t0 = now_ns();
+	for(int r=0; r<reps; ++r)
+		run_old();
+	double t1 = now_ns();
+	for(int r=0; r<reps; ++r) {
+		for(long i=0; i<STREAM_LEN; ++i) {
+			rcreg = stream[i];
+			pir1_b5 = 1;
+			old_interrupt();
+			old_rx_tail = old_rx_head;
+		}
+	}
+	double t2 = now_ns();
+	for(int r=0; r<reps; ++r)
+		run_new();
+	double t3 = now_ns();
+	for(int r=0; r<reps; ++r) {
+		for(long i=0; i<STREAM_LEN; ++i) {
+			rcreg = stream[i];
+			pir1_b5 = 1;
+			interrupt();
+			rx_tail = rx_head;
+			rt_tail = rt_head;
+		}
+	}
+	double t4 = now_ns();
+	double bytes = (double)reps * STREAM_LEN;
+	printf("ns per byte   total  interrupt  main loop\n");
+	printf("old          %6.1f     %6.1f     %6.1f\n", (t1-t0)/bytes, (t2-t1)/bytes, ((t1-t0)-(t2-t1))/bytes);
+	printf("new          %6.1f     %6.1f     %6.1f\n", (t3-t2)/bytes, (t4-t3)/bytes, ((t3-t2)-(t4-t3))/bytes);
+	printf("%s\n", fail? "FAIL" : "PASS");
+	return fail;
+}
@@ -0,0 +1,155 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST TEST: NOTE CV PITCH
+//
+// Checks the note table pitch calculation (cv_note_table and
+// cv_write_pitch) against the arithmetic it replaced (kept in
+// old_cv.h as the reference), then times both.
+//
+// The translated cv.c is included so its static functions
+// can be called directly.
+//
+//////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <time.h>
+#include "cv.c"
+#include "old_cv.h"
+
+// new DAC value for a pitch in MIDI note * 256 units
+static int new_pitch(byte which, __bc_long pitch) {
+	cv_write_pitch(which, pitch);
+	return l_dac[which];
+}
+
+//
+// TEST SETUP
+//
+
+// scale and offset settings (scale 0 = calibration off)
+static const byte cal[][2] = {
+	{0, 0}, {64, 64}, {127, 127}, {1, 1}, {127, 1}, {1, 127}, {90, 40}
+};
+#define NUM_CAL (sizeof(cal)/sizeof(cal[0]))
+
+static const char *mode_name(byte mode) {
+	switch(mode) {
+	case CV_NOTE_HZV: 	return "Hz/V";
+	case CV_NOTE_12VO: 	return "1.2V/oct";
+	default: 			return "1V/oct";
+	}
+}
+
+static void setup(byte mode, byte scale, byte ofs) {
+	memset(l_cv, 0, sizeof(l_cv));
+	memset(l_cal_point, 64, sizeof(l_cal_point));
+	l_mod_active = 0;
+	l_cv[0].event.mode = mode;
+	l_cv[0].event.scale = scale;
+	l_cv[0].event.ofs = ofs;
+	cv_note_table(0);
+}
+
+// compare old and new over a range of pitches. step 256 gives
+// whole notes only. Returns largest difference in DAC counts
+static int compare(__bc_long from, __bc_long to, __bc_long step) {
+	int worst = 0;
+	for(__bc_long pitch = from; pitch <= to; pitch += step) {
+		int diff = new_pitch(0, pitch) - old_pitch(0, pitch);
+		if(diff < 0)
+			diff = -diff;
+		if(diff > worst)
+			worst = diff;
+	}
+	return worst;
+}
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//
+// TESTS
+//
+
+// every pitch from note 0 to the top of note 120, for each
+// scheme and calibration. Hz/V is compared up to C6 (note 72),
+// the highest note the old code produced correctly. The new
+// code rounds where the old one truncated, and Hz/V bends 
+// follow the curve rather than a straight line, so results
+// may differ by up to MAX_DIFF counts
+#define MAX_DIFF	2
+static int test_equivalence() {
+	static const byte modes[] = {CV_NOTE, CV_NOTE_12VO, CV_NOTE_HZV};
+	int fail = 0;
+	printf("%-9s %-9s %12s %12s\n", "scheme", "scale/ofs", "whole notes", "with bend");
+	for(int m=0; m<3; ++m) {
+		for(int c=0; c<NUM_CAL; ++c) {
+			setup(modes[m], cal[c][0], cal[c][1]);
+			__bc_long top = (modes[m] == CV_NOTE_HZV)? 72*256 : 120*256 + 255;
+			int notes_worst = compare(0, top, 256);
+			int bend_worst = compare(0, top, 1);
+			char name[16];
+			snprintf(name, sizeof(name), cal[c][0]? "%d/%d" : "off", cal[c][0], cal[c][1]);
+			printf("%-9s %-9s %12d %12d\n", mode_name(modes[m]), name, notes_worst, bend_worst);
+			if(notes_worst > MAX_DIFF || bend_worst > MAX_DIFF) {
+				fail = 1;
+			}
+		}
+	}
+	printf("(largest difference from the old arithmetic, in DAC counts)\n");
+	return fail;
+}
+
+// Hz/V above C6: the old code wrapped back down an octave
+// or more, the note table holds at C6
+static int test_hzv_top() {
+	setup(CV_NOTE_HZV, 0, 0);
+	int fail = 0;
+	for(__bc_long pitch = 72*256; pitch <= 120*256 + 255; ++pitch) {
+		if(new_pitch(0, pitch) != 4000) {
+			fail = 1;
+		}
+	}
+	printf("Hz/V above C6 holds at 4000: %s (old code gave %d for C#6)\n",
+		fail? "no" : "yes", old_pitch(0, 73*256));
+	return fail;
+}
+
+// time each method over every pitch from note 0 to 120. The
+// host has a hardware divider (and gcc turns the constant 
+// divides into multiplies), so this does not show the cost 
+// of the PIC's software divide
+static void benchmark() {
+	static const byte modes[] = {CV_NOTE, CV_NOTE_HZV};
+	const int reps = 200;
+	volatile int sink = 0;
+	for(int m=0; m<2; ++m) {
+		setup(modes[m], 90, 40);
+		long calls = (long)reps * (120*256);
+		double t0 = now_ns();
+		for(int r=0; r<reps; ++r)
+			for(__bc_long pitch = 0; pitch < 120*256; ++pitch)
+				sink += old_pitch(0, pitch);
+		double t1 = now_ns();
+		for(int r=0; r<reps; ++r)
+			for(__bc_long pitch = 0; pitch < 120*256; ++pitch)
+				sink += new_pitch(0, pitch);
+		double t2 = now_ns();
+		for(int r=0; r<reps; ++r)
+			cv_note_table(0);
+		double t3 = now_ns();
+		printf("%-9s old %6.1f ns/note  new %6.1f ns/note  table rebuild %6.1f ns\n",
+			mode_name(modes[m]), (t1-t0)/calls, (t2-t1)/calls, (t3-t2)/reps);
+	}
+}
+
+int main() {
+	int fail = 0;
+	fail |= test_equivalence();
+	fail |= test_hzv_top();
+	benchmark();
+	printf("%s\n", fail? "FAIL" : "PASS");
+	return fail;
+}
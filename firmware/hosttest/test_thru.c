@@ -0,0 +1,231 @@
+//////////////////////////////////////////////////////////////
+//
+// HOST TEST: SOFT MIDI THRU
+//
+// Feeds MIDI into the receive interrupt at the full rate of
+// one byte every 320us, with a model of the UART transmitter
+// behind txreg, and checks in each THRU mode that the output
+// carries the expected messages in the same order. Reports
+// how long each message waits between arriving and starting
+// to go out, and how full the transmit buffer gets. One run
+// also sends a statistics report part way through, which is
+// fitted in between THRU messages: every message must still
+// be forwarded, and the report must be complete.
+//
+// The translated cvocd.c is included so its static data can
+// be reached, with writes to txreg routed to the UART model.
+//
+//////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include "boostc.h"
+
+// UART MODEL
+// A byte written to txreg goes to the shift register when that
+// is free, and takes BYTE_US to send. Until then it waits in
+// txreg, and the TXIF flag (pir1.4) is clear
+#define BYTE_US		320
+#define STEP_US		8
+#define STREAM_LEN	20000
+static long sim_time;						// us
+static unsigned char out[4*STREAM_LEN];		// bytes sent
+static long out_start[4*STREAM_LEN];		// time each started to go out
+static long out_len;
+
+static volatile unsigned char *uart_txreg() {
+	long start = sim_time;
+	if(out_len && out_start[out_len-1] + BYTE_US > start) {
+		start = out_start[out_len-1] + BYTE_US;
+	}
+	out_start[out_len] = start;
+	pir1_b4 = (start <= sim_time);
+	return &out[out_len++];
+}
+
+static void uart_update() {
+	pir1_b4 = !(out_len && out_start[out_len-1] > sim_time);
+}
+
+#define txreg (*uart_txreg())
+#include "cvocd.c"
+#undef txreg
+#include "midi_stream.h"
+
+//
+// TEST SETUP
+//
+
+static unsigned char stream[STREAM_LEN];
+static MIDI_MSG in_msgs[STREAM_LEN], out_msgs[4*STREAM_LEN];
+
+// time taken to send the report
+static long report_time;
+
+// send the stream in, one byte every BYTE_US, and run until
+// the output has drained. A report is requested at report_at
+// (if not negative). Returns the largest number of bytes
+// waiting in the transmit buffer
+static int run(byte thru, long report_at) {
+	memset((void*)tx_buffer, 0, sizeof(tx_buffer));
+	tx_head = tx_tail = tx_realtime = 0;
+	thru_in_status = thru_out_status = thru_len = thru_count = thru_pass = 0;
+	rx_status = rx_param = 0;
+	rx_sysex = SYSEX_NONE;
+	rx_head = rx_tail = rt_head = rt_tail = 0;
+	memset((void*)rx_stats, 0, sizeof(rx_stats));
+	g_global.thru = thru;
+	pie1_b4 = 0;
+	out_len = 0;
+	report_time = -1;
+	long requested = report_at;
+	int peak = 0;
+	long next = 0;
+	long end = (long)(STREAM_LEN + 1) * BYTE_US;
+	for(sim_time = 0; next < STREAM_LEN || pie1_b4 || report_param != REPORT_IDLE || sim_time < end; sim_time += STEP_US) {
+		uart_update();
+		// a byte has been received at the end of each byte time
+		if(next < STREAM_LEN && sim_time >= (next+1) * BYTE_US) {
+			rcreg = stream[next++];
+			pir1_b5 = 1;
+		}
+		if(pir1_b5 || (pie1_b4 && pir1_b4)) {
+			interrupt();
+		}
+		// the main loop keeps the receive queues empty, and 
+		// sends the report
+		rx_tail = rx_head;
+		rt_tail = rt_head;
+		if(report_at >= 0 && sim_time >= report_at) {
+			stats_request(0);
+			report_at = -1;
+		}
+		stats_run();
+		if(requested >= 0 && report_at < 0 && report_param == REPORT_IDLE && report_time < 0) {
+			report_time = sim_time - requested;
+		}
+		int waiting = (tx_head - tx_tail) & SZ_TXBUFFER_MASK;
+		if(waiting > peak) {
+			peak = waiting;
+		}
+	}
+	return peak;
+}
+
+// is a message from the input expected on the output?
+static int passes(byte thru, const MIDI_MSG *msg) {
+	switch(thru) {
+	case THRU_REALTIME:
+		return msg->status >= 0xF8;
+	case THRU_UNUSED:
+		return msg->status >= 0xF0 || !g_midi_filter[msg->status & 0x0F];
+	}
+	return 1;
+}
+
+// is an output message a block of the statistics report?
+static int is_report(const MIDI_MSG *msg) {
+	return msg->status == MIDI_SYSEX_BEGIN && msg->data[1] == MY_SYSEX_ID0;
+}
+
+// find the next output message at or after o of the same kind
+// (realtime or not) as msg, skipping report blocks
+static int next_out(int o, int out_count, const MIDI_MSG *msg) {
+	while(o < out_count && (is_report(&out_msgs[o]) || 
+		(out_msgs[o].status >= 0xF8) != (msg->status >= 0xF8))) {
+		++o;
+	}
+	return o;
+}
+
+static int test_mode(byte thru, const char *name, long report_at) {
+	int peak = run(thru, report_at);
+	int in_count = midi_parse(stream, STREAM_LEN, in_msgs);
+	int out_count = midi_parse(out, out_len, out_msgs);
+
+	// the output must be exactly the expected messages in order,
+	// with the blocks of the report in between. Realtime messages
+	// are taken apart, since they can go ahead of the others
+	int fail = 0;
+	int o = 0, o_rt = 0;
+	int forwarded = 0;
+	long worst = 0;
+	double total = 0;
+	for(int i=0; i<in_count; ++i) {
+		if(!passes(thru, &in_msgs[i])) {
+			continue;
+		}
+		int *po = (in_msgs[i].status >= 0xF8)? &o_rt : &o;
+		*po = next_out(*po, out_count, &in_msgs[i]);
+		long arrived = (in_msgs[i].last+1) * BYTE_US;
+		if(*po >= out_count ||
+			in_msgs[i].status != out_msgs[*po].status ||
+			in_msgs[i].data[0] != out_msgs[*po].data[0] ||
+			in_msgs[i].data[1] != out_msgs[*po].data[1]) {
+			printf("%s: message %d not forwarded\n", name, i);
+			fail = 1;
+			break;
+		}
+		// from the last byte arriving to the last byte starting
+		// to go out
+		long wait = out_start[out_msgs[*po].last] - arrived;
+		if(wait > worst) {
+			worst = wait;
+		}
+		total += wait;
+		++*po;
+		++forwarded;
+	}
+	int reports = 0;
+	for(int k=0; k<out_count; ++k) {
+		reports += is_report(&out_msgs[k]);
+	}
+	if(!fail && forwarded + reports != out_count) {
+		printf("%s: %d extra messages\n", name, out_count - forwarded - reports);
+		fail = 1;
+	}
+	printf("%-9s %8d %8d %7d %9.0f %9ld %10d %6u\n", name, in_count, forwarded, reports,
+		forwarded? total/forwarded : 0.0, worst, peak, rx_stats[STAT_TX_LOST]);
+	// one block for each statistic
+	int expected = 0;
+	unsigned int value;
+	for(int param=0; report_at >= 0 && param<0x80; ++param) {
+		expected += !!stats_value(param, &value);
+	}
+	if(reports != expected) {
+		printf("%s: %d of %d report blocks\n", name, reports, expected);
+		fail = 1;
+	}
+	if(report_at >= 0) {
+		printf("%s: report took %ldms\n", name, report_time/1000);
+	}
+	// a byte or two of delay at most (or a transmit buffer full
+	// when the report is in the way), and nothing lost
+	if(worst > ((report_at >= 0)? SZ_TXBUFFER*BYTE_US : 2*BYTE_US) || rx_stats[STAT_TX_LOST]) {
+		fail = 1;
+	}
+	return fail;
+}
+
+int main() {
+	int fail = 0;
+	// this unit uses channels 0 and 1 (the stream uses 0-3)
+	route_pending = 0;
+	memset((void*)g_midi_filter, 0, sizeof(g_midi_filter));
+	g_midi_filter[0] = MIDI_FILTER_NOTE|MIDI_FILTER_BEND;
+	g_midi_filter[1] = MIDI_FILTER_CC;
+	midi_stream(stream, STREAM_LEN, 7, 4);
+	// end with clock after the last whole message, so THRU is
+	// left between messages
+	int count = midi_parse(stream, STREAM_LEN, in_msgs);
+	for(long i=in_msgs[count-1].last+1; i<STREAM_LEN; ++i) {
+		stream[i] = MIDI_SYNCH_TICK;
+	}
+
+	printf("%-9s %8s %8s %7s %9s %9s %10s %6s\n", "mode", "in", "out", "reports", "mean(us)", "worst(us)", "tx buffer", "lost");
+	fail |= test_mode(THRU_ALL, "all", -1);
+	fail |= test_mode(THRU_UNUSED, "unused", -1);
+	fail |= test_mode(THRU_REALTIME, "realtime", -1);
+	fail |= test_mode(THRU_ALL, "report", STREAM_LEN/3 * BYTE_US);
+	printf("(wait from a message arriving to it starting to go out)\n");
+	printf("%s\n", fail? "FAIL" : "PASS");
+	return fail;
+}
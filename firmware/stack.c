@@ -31,6 +31,8 @@
 
 #define PARA_CHORD	1
 
+#define BEND_INTERVAL_MAX	40	// longest ms between bend messages that is interpolated
+
 //
 // GLOBAL DATA
 //
@@ -39,6 +41,19 @@
 NOTE_STACK g_stack[NUM_NOTE_STACKS] = {0};
 NOTE_STACK_CFG g_stack_cfg[NUM_NOTE_STACKS];
 
+//
+// LOCAL DATA
+//
+
+// routing table: bit mask of the stacks listening to each MIDI channel
+static byte l_stack_route[16];
+
+// bit mask of the stacks with a bend change to send to the CV outputs
+static byte l_bend_pending;
+
+// bit mask of the stacks with a poly aftertouch change to send to the CV outputs
+static byte l_touch_pending;
+
 //
 // PRIVATE FUNCTIONS
 //
@@ -102,14 +117,17 @@ static void prioritize_note(NOTE_STACK *pstack, byte which_stack, byte priority,
 			pstack->out[0] = NO_NOTE_OUT; // not any more!
 			gate_event(EV_NO_NOTE_A, which_stack);
 			gate_event(EV_NOTES_OFF, which_stack);
+			cv_event(EV_NOTES_OFF, which_stack);
 		}
 	}
 	else if(prev_out != pstack->note[0]) { 		// change in note to play?
 		pstack->out[0] = pstack->note[0]; 
+		pstack->touch[0] = 0;
 		cv_event(EV_NOTE_A, which_stack); 		// update CV out
 		gate_event(EV_NOTE_A, which_stack); 	// event for change of top note
 		if(prev_out == NO_NOTE_OUT) { 
 			gate_event(EV_NOTE_ON, which_stack); // event for first note
+			cv_event(EV_NOTE_ON, which_stack);
 		}		
 	}
 }
@@ -121,9 +139,11 @@ static void cycle_note(NOTE_STACK *pstack, byte which_stack, byte cycle_size, by
 	byte i, any_note;
 	if(vel) {
 		pstack->out[pstack->index] = note;
+		pstack->touch[pstack->index] = 0;
 		cv_event(EV_NOTE_A + pstack->index, which_stack);
 		gate_event(EV_NOTE_A + pstack->index, which_stack);
 		gate_event(EV_NOTE_ON, which_stack);
+		cv_event(EV_NOTE_ON, which_stack);
 		if(++pstack->index >= cycle_size ) {
 			pstack->index = 0;
 		}
@@ -141,6 +161,7 @@ static void cycle_note(NOTE_STACK *pstack, byte which_stack, byte cycle_size, by
 		}
 		if(!any_note) {
 			gate_event(EV_NOTES_OFF, which_stack);			
+			cv_event(EV_NOTES_OFF, which_stack);
 		}
 	}	
 }
@@ -162,9 +183,11 @@ static void poly_chord_note(NOTE_STACK *pstack, byte which_stack, byte chord_siz
 			i = chord_size - 1; // no free slots, steal the last slot
 		}
 		pstack->out[i] = note;
+		pstack->touch[i] = 0;
 		cv_event(EV_NOTE_A + i, which_stack);
 		gate_event(EV_NOTE_A + i, which_stack);
 		gate_event(EV_NOTE_ON, which_stack);
+		cv_event(EV_NOTE_ON, which_stack);
 	}
 	else {
 		// note off - remove old note
@@ -180,6 +203,7 @@ static void poly_chord_note(NOTE_STACK *pstack, byte which_stack, byte chord_siz
 		}
 		if(!any_note) {
 			gate_event(EV_NOTES_OFF, which_stack);			
+			cv_event(EV_NOTES_OFF, which_stack);
 		}
 	}
 }	
@@ -198,6 +222,7 @@ static void para_chord_note(NOTE_STACK *pstack, byte which_stack, byte chord_siz
 		for(int i=0; i<chord_size; ++i) {		
 			if(pstack->note[from_index] != pstack->out[i]) {
 				pstack->out[i] = pstack->note[from_index];
+				pstack->touch[i] = 0;
 				cv_event(EV_NOTE_A+i, which_stack);
 			}
 			if(++from_index >= pstack->count) {
@@ -206,6 +231,7 @@ static void para_chord_note(NOTE_STACK *pstack, byte which_stack, byte chord_siz
 		}
 		if(pstack->count <= chord_size) {
 			gate_event(EV_NOTE_ON, which_stack);		// event if any audible note changed
+			cv_event(EV_NOTE_ON, which_stack);
 		}
 		if(pstack->count == 1) {
 			gate_event(EV_NOTE_A, which_stack);	// event when first note goes on
@@ -215,6 +241,7 @@ static void para_chord_note(NOTE_STACK *pstack, byte which_stack, byte chord_siz
 		if(!pstack->count) {
 			gate_event(EV_NO_NOTE_A, which_stack);	// events when all notes go off
 			gate_event(EV_NOTES_OFF, which_stack);			
+			cv_event(EV_NOTES_OFF, which_stack);
 		}
 	}
 }	
@@ -271,14 +298,14 @@ static void poly_chord_note(NOTE_STACK *pstack, byte which_stack, byte chord_siz
 // HANDLE A MIDI NOTE
 void stack_midi_note(byte chan, byte note, byte vel) 
 {
-	// for each note stack
-	for(byte which_stack=0; which_stack<NUM_NOTE_STACKS; ++which_stack) {
+	// for each note stack listening on the channel
+	byte mask = l_stack_route[chan];
+	for(byte which_stack=0; mask; ++which_stack, mask>>=1) {
+		if(!(mask & 1))
+			continue;
 		NOTE_STACK *pstack = &g_stack[which_stack];		
 		NOTE_STACK_CFG *pcfg = &g_stack_cfg[which_stack];		
 
-		// channel matches?
-		if(!IS_CHAN(pcfg->chan, chan))
-			continue;
 		// note matches?
 		if(!IS_NOTE_MATCH(pcfg->note_min, pcfg->note_max, note))
 			continue;
@@ -322,22 +349,93 @@ void stack_midi_note(byte chan, byte note, byte vel)
 // bend is the raw unscaled midi value
 void stack_midi_bend(byte chan, int bend) 
 {	
-	char i;
-	for(i=0; i<NUM_NOTE_STACKS; ++i) {
+	// for each note stack listening on the channel
+	byte mask = l_stack_route[chan];
+	for(byte i=0; mask; ++i, mask>>=1) {
+		if(!(mask & 1))
+			continue;
 		NOTE_STACK_CFG *pcfg = &g_stack_cfg[i];		
 		NOTE_STACK *pstack = &g_stack[i];		
-		
-		// does the MIDI channel match?
-		if(!IS_CHAN(pcfg->chan, chan))
-			continue;
 
 		// pitch bend units are 256 * number of midi notes offset 
 		// and can be positive or negative
 		int new_bend = ((long)pcfg->bend_range * (bend - 8192))/32;
+		if(pcfg->bend_smooth) {
+			// ramp to the new bend over the time since the last 
+			// bend message, which is when the next one is expected
+			byte ms = pstack->bend_ms;
+			pstack->bend_ms = 0;
+			if(ms > BEND_INTERVAL_MAX) {
+				ms = BEND_INTERVAL_MAX;
+			}
+			pstack->bend_target = new_bend;
+			if(ms > 1) {
+				int step = ((long)new_bend - pstack->bend)/ms;
+				if(!step && new_bend != pstack->bend) {
+					step = (new_bend > pstack->bend)? 1 : -1;
+				}
+				pstack->bend_step = step;
+				continue;
+			}
+			pstack->bend_step = 0;
+		}
+		// the CV outputs are updated on the next ms tick, so 
+		// there is at most one bend DAC update per tick
 		if(pstack->bend != new_bend) {
 			pstack->bend = new_bend;
+			l_bend_pending |= (1<<i);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// HANDLE MIDI POLY AFTERTOUCH
+// Pressure is kept for the notes assigned to stack outputs
+void stack_midi_poly_touch(byte chan, byte note, byte value) 
+{
+	byte mask = l_stack_route[chan];
+	for(byte i=0; mask; ++i, mask>>=1) {
+		if(!(mask & 1))
+			continue;
+		NOTE_STACK *pstack = &g_stack[i];		
+		for(byte j=0; j<4; ++j) {
+			if(pstack->out[j] == note && pstack->touch[j] != value) {
+				pstack->touch[j] = value;
+				l_touch_pending |= (1<<i);
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// RUN PITCH BEND INTERPOLATION AND AFTERTOUCH UPDATES
+// Called once per ms. Changes are sent to the CV outputs at
+// most once per tick however many messages arrived
+void stack_run() 
+{
+	for(byte i=0; i<NUM_NOTE_STACKS; ++i) {
+		NOTE_STACK *pstack = &g_stack[i];		
+		if(pstack->bend_ms < 0xFF) {
+			++pstack->bend_ms;
+		}
+		int step = pstack->bend_step;
+		if(step) {
+			long bend = pstack->bend + step;
+			if((step > 0 && bend >= pstack->bend_target) || (step < 0 && bend <= pstack->bend_target)) {
+				bend = pstack->bend_target;
+				pstack->bend_step = 0;
+			}
+			pstack->bend = bend;
+			l_bend_pending |= (1<<i);
+		}
+		if(l_bend_pending & (1<<i)) {
+			l_bend_pending &= ~(1<<i);
 			cv_event(EV_BEND, i);
 		}
+		if(l_touch_pending & (1<<i)) {
+			l_touch_pending &= ~(1<<i);
+			cv_event(EV_TOUCH, i);
+		}
 	}
 }
 
@@ -393,6 +491,12 @@ byte stack_nrpn(byte which_stack, byte param_lo, byte value_hi, byte value_lo)
 		pcfg->bend_range = value_lo;
 		return 1;	
 
+	//////////////////////////////////////////////////
+	// SELECT PITCH BEND INTERPOLATION
+	case NRPNL_PB_SMOOTH:
+		pcfg->bend_smooth = !!value_lo;
+		return 1;	
+
 	//////////////////////////////////////////////////
 	// SELECT NOTE PRIORITY
 	case NRPNL_PRIORITY:
@@ -413,6 +517,26 @@ byte *stack_storage(int *len) {
 	return (byte*)&g_stack_cfg;
 }
 
+////////////////////////////////////////////////////////////
+// BUILD ROUTING TABLE FROM NOTE STACK CONFIG
+void stack_route() {
+	for(byte chan=0; chan<16; ++chan) {
+		byte mask = 0;
+		for(byte which_stack=0; which_stack<NUM_NOTE_STACKS; ++which_stack) {
+			if(IS_CHAN(g_stack_cfg[which_stack].chan, chan)) {
+				mask |= (1<<which_stack);
+			}
+		}
+		l_stack_route[chan] = mask;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// GET MIDI INPUT FILTER BITS FOR A CHANNEL
+byte stack_filter(byte chan) {
+	return l_stack_route[chan]? (MIDI_FILTER_NOTE|MIDI_FILTER_BEND) : 0;
+}
+
 ////////////////////////////////////////////////////////////
 // RESET NOTE STACK STATE
 void stack_reset() {
@@ -422,11 +546,16 @@ void stack_reset() {
 		g_stack[i].out[1] = NO_NOTE_OUT;
 		g_stack[i].out[2] = NO_NOTE_OUT;
 		g_stack[i].out[3] = NO_NOTE_OUT;
+		memset(g_stack[i].touch, 0, sizeof(g_stack[i].touch));
 		g_stack[i].bend = 0;
+		g_stack[i].bend_target = 0;
+		g_stack[i].bend_step = 0;
 		g_stack[i].vel = 0;		
 		g_stack[i].index = 0;		
 		gate_event(EV_NOTES_OFF, i);
 	}
+	l_bend_pending = 0;
+	l_touch_pending = 0;
 }
  
 ////////////////////////////////////////////////////////////
@@ -434,6 +563,7 @@ void stack_reset() {
 void stack_init()
 {
 	memset(g_stack_cfg, 0, sizeof(g_stack_cfg));
+	memset(l_stack_route, 0, sizeof(l_stack_route));
 }
 
 //
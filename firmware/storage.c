@@ -34,18 +34,25 @@
 // LOCAL DATA
 //
 
-#define MAGIC_COOKIE 0xA9
+#define MAGIC_COOKIE 0xB3
+
+// state of background patch write
+#define STORAGE_IDLE 0xFF
+static byte l_cookie = MAGIC_COOKIE;		// cookie is written as block 0
+static byte l_write_block = STORAGE_IDLE;	// block being written
+static int l_write_pos;						// position within the block
+static int l_write_addr;					// EEPROM address of next byte
 
 //
 // LOCAL FUNCTIONS
 //
 
 ////////////////////////////////////////////////////
-// SAVE DATA TO EEPROM
-static void storage_write(byte *data, int len, int* addr)
+// READ DATA FROM EEPROM
+static void storage_read(byte *data, int len, int* addr)
 {
 	while(len > 0) {
-		eeprom_write(*addr, *data);
+		*data = eeprom_read(*addr);
 		++(*addr);
 		++data;
 		--len;
@@ -53,28 +60,78 @@ static void storage_write(byte *data, int len, int* addr)
 }
 
 ////////////////////////////////////////////////////
-// READ DATA FROM EEPROM
-static void storage_read(byte *data, int len, int* addr)
+// GET A BLOCK OF CONFIG DATA FOR BACKGROUND WRITE
+static byte *storage_block(byte block, int *len)
 {
-	while(len > 0) {
-		*data = eeprom_read(*addr);
-		++(*addr);
-		++data;
-		--len;
+	switch(block) {
+	case 0: 
+		*len = 1;
+		return &l_cookie;
+	case 1: return global_storage(len);
+	case 2: return stack_storage(len);
+	case 3: return cv_storage(len);
+	case 4: return gate_storage(len);
+	case 5: return cv_cal_storage(len);
+	case 6: return cv_mod_storage(len);
 	}
+	return 0;
 }
 
+//
+// GLOBAL FUNCTIONS
+//
+
 ////////////////////////////////////////////////////
 // SAVE ALL CONFIG TO EEPROM
 void storage_write_patch()
 {
-	int len = 0;
-	eeprom_write(0, MAGIC_COOKIE);
-	int storage_ofs = 1;
-	storage_write(global_storage(&len), len, &storage_ofs);
-	storage_write(stack_storage(&len), len, &storage_ofs);
-	storage_write(cv_storage(&len), len, &storage_ofs);
-	storage_write(gate_storage(&len), len, &storage_ofs);
+	storage_begin_write();
+	while(storage_run());
+}
+
+////////////////////////////////////////////////////
+// START WRITING ALL CONFIG TO EEPROM IN THE BACKGROUND
+// Restarts from the beginning if a write is already
+// underway, so the latest config is always stored
+void storage_begin_write()
+{
+	l_write_block = 0;
+	l_write_pos = 0;
+	l_write_addr = 0;
+}
+
+////////////////////////////////////////////////////
+// CONTINUE A BACKGROUND WRITE
+// Called from the main loop. Starts at most one EEPROM 
+// byte write per call, and only when the previous write 
+// has finished so we never wait on the EEPROM. Bytes that 
+// are unchanged are skipped. Returns nonzero while busy
+byte storage_run()
+{
+	int len;
+	byte *data;
+	while(l_write_block != STORAGE_IDLE) {
+		if(eecon1.1) {	// WR: previous write still in progress
+			return 1;
+		}
+		data = storage_block(l_write_block, &len);
+		if(!data) {
+			l_write_block = STORAGE_IDLE;
+			break;
+		}
+		if(l_write_pos >= len) {
+			++l_write_block;
+			l_write_pos = 0;
+			continue;
+		}
+		byte value = data[l_write_pos++];
+		if(eeprom_read(l_write_addr) != value) {
+			eeprom_write(l_write_addr++, value);
+			return 1;
+		}
+		++l_write_addr;
+	}
+	return 0;
 }
 
 ////////////////////////////////////////////////////
@@ -90,6 +147,8 @@ void storage_read_patch()
 	storage_read(stack_storage(&len), len, &storage_ofs);
 	storage_read(cv_storage(&len), len, &storage_ofs);
 	storage_read(gate_storage(&len), len, &storage_ofs);
+	storage_read(cv_cal_storage(&len), len, &storage_ofs);
+	storage_read(cv_mod_storage(&len), len, &storage_ofs);
 }
 
 //
@@ -45,6 +45,7 @@
 #define NRPNH_CV2		        22
 #define NRPNH_CV3		        23
 #define NRPNH_CV4		        24
+#define NRPNL_CAL_POINT     97
 #define NRPNL_CAL_SCALE  	  98
 #define NRPNL_CAL_OFS  		  99
 #define NRPNL_SAVE          100
@@ -62,6 +63,12 @@
 #define OFS_CAL_INTERVAL_MV ((1000.0*(OFS_CAL_INTERVAL))/12.0)
 #define OFS_CAL_CYCLES     6
 
+// parameters for the per-octave calibration process
+#define POINT_CAL_OCTAVES       9     // number of octave points held by CV.OCD
+#define POINT_CAL_FIRST_OCTAVE  1     // lowest octave measured (0V is not reliable)
+#define POINT_CAL_LAST_OCTAVE   8     // highest octave measured
+#define POINT_CAL_MV_PER_COUNT  2.0   // millivolts per DAC count
+
 // EEPROM parameters
 #define EEPROM_COOKIE_ADDR  9
 #define EEPROM_COOKIE_VALUE 123
@@ -287,6 +294,24 @@ void set_ofs_adj(byte which, int amount)
   send_nrpn(NRPNH_CV1 + which, NRPNL_CAL_OFS, 0, amount + 64);
 }
 
+//////////////////////////////////////////////////////////////////////////
+// SEND NRPN TO SET CORRECTION AT AN OCTAVE POINT (IN DAC COUNTS)
+void set_cal_point(byte which, byte octave, int amount) 
+{
+  if(amount > 63) amount = 63;
+  if(amount < -63) amount = -63;
+  send_nrpn(NRPNH_CV1 + which, NRPNL_CAL_POINT, octave, amount + 64);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// SEND NRPNS TO CLEAR ALL OCTAVE POINT CORRECTIONS
+void clear_cal_points(byte which) 
+{
+  for(int i=0; i<POINT_CAL_OCTAVES; ++i) {
+    set_cal_point(which, i, 0);
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////
 // SEND NRPN TO COMMIT NEW VALUES
 void save_calibration() 
@@ -594,6 +619,60 @@ boolean offset_calibration(byte which, int &ofs_adj)
   return true;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+// PER-OCTAVE CALIBRATION ROUTINES
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+// Measure C in each octave once gain and offset are set, and upload 
+// a correction for the residual error at each octave point
+boolean point_calibration(byte which) 
+{
+  int points[POINT_CAL_OCTAVES] = {0};
+  for(int octave = POINT_CAL_FIRST_OCTAVE; octave <= POINT_CAL_LAST_OCTAVE; ++octave) {
+    double mv[4];
+    int note = 24 + 12 * octave;
+    double expected = 1000.0 * octave;
+    test_note(which,note,mv);
+    double result = mv[which];
+    double error = result - expected;
+    int adj = -(int)floor(0.5 + error/POINT_CAL_MV_PER_COUNT);
+    Serial.print("POINT:");Serial.print(which);Serial.print(":");
+    Serial.print("note ");
+    Serial.print(note, DEC);
+    Serial.print(" expected ");
+    Serial.print(expected);
+    Serial.print("->");
+    Serial.print(result);
+    Serial.print(" error ");
+    Serial.print(error);
+    Serial.print(" adj ");
+    Serial.println(adj);
+    if(adj < -60 || adj > 60) {
+      Serial.println("*** ERROR: OUT OF TOLERANCE ***");
+      return false;
+    }
+    points[octave] = adj;
+  }
+
+  // points outside the measured range follow the nearest measured point
+  for(int octave = 0; octave < POINT_CAL_FIRST_OCTAVE; ++octave) {
+    points[octave] = points[POINT_CAL_FIRST_OCTAVE];
+  }
+  for(int octave = POINT_CAL_LAST_OCTAVE + 1; octave < POINT_CAL_OCTAVES; ++octave) {
+    points[octave] = points[POINT_CAL_LAST_OCTAVE];
+  }
+  for(int octave = 0; octave < POINT_CAL_OCTAVES; ++octave) {
+    set_cal_point(which, octave, points[octave]);
+  }
+  return true;
+}
+
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
@@ -609,12 +688,16 @@ boolean calibrate() {
   int ofs[4] = {0};
   for(int i=0; i<4; ++i) {
     all_notes_off();
+    clear_cal_points(i);
     if(!gain_calibration(i, scale[i])) {
         return false;
      }
     if(!offset_calibration(i, ofs[i])) {
       return false;
     }
+    if(!point_calibration(i)) {
+      return false;
+    }
   }
   save_calibration();
   Serial.println("Done...");